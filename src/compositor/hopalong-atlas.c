@@ -0,0 +1,551 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hopalong-macros.h"
+#include "hopalong-atlas.h"
+
+#include <wlr/render/egl.h>
+#include <wlr/render/gles2.h>
+#include <wlr/util/log.h>
+#include <GLES2/gl2.h>
+
+#define ATLAS_INITIAL_SIZE	(1024)
+#define ATLAS_MAX_SIZE		(4096)
+
+/* transparent gap around each image, so that filtering does not bleed */
+#define ATLAS_PADDING		(1)
+
+/* images which are updated get slots rounded up to a multiple of this */
+#define ATLAS_SIZE_CLASS	(64)
+
+static bool
+shelf_alloc(struct wl_array *shelves, int atlas_width, int atlas_height, int width, int height, int *x, int *y)
+{
+	struct hopalong_atlas_shelf *shelf;
+	int next_y = 0;
+
+	wl_array_for_each(shelf, shelves)
+	{
+		next_y = shelf->y + shelf->height;
+
+		/* don't put small images on tall shelves */
+		if (height > shelf->height || height < shelf->height * 3 / 4)
+			continue;
+
+		if (atlas_width - shelf->used < width)
+			continue;
+
+		*x = shelf->used;
+		*y = shelf->y;
+		shelf->used += width;
+
+		return true;
+	}
+
+	if (width > atlas_width || next_y + height > atlas_height)
+		return false;
+
+	shelf = wl_array_add(shelves, sizeof(*shelf));
+	return_val_if_fail(shelf != NULL, false);
+
+	*shelf = (struct hopalong_atlas_shelf){
+		.y = next_y,
+		.height = height,
+		.used = width,
+	};
+
+	*x = 0;
+	*y = next_y;
+
+	return true;
+}
+
+static void
+copy_pixels(uint32_t *dst, int dst_width, int dst_x, int dst_y,
+	const void *src, int src_stride, int src_x, int src_y, int width, int height)
+{
+	for (int row = 0; row < height; row++)
+	{
+		const uint8_t *src_row = (const uint8_t *) src + (src_y + row) * src_stride + src_x * 4;
+		memcpy(dst + (dst_y + row) * dst_width + dst_x, src_row, width * 4);
+	}
+}
+
+struct repack_item {
+	struct hopalong_atlas_entry *entry;
+	int x, y;
+};
+
+static int
+repack_item_cmp(const void *a, const void *b)
+{
+	const struct repack_item *item_a = a, *item_b = b;
+
+	return item_b->entry->slot_height - item_a->entry->slot_height;
+}
+
+/*
+ * Packs all live images again, tallest first, into an atlas of the given
+ * size.  Leaves the atlas untouched if they do not fit.
+ */
+static bool
+hopalong_atlas_repack(struct hopalong_atlas *atlas, int width, int height)
+{
+	int nentries = wl_list_length(&atlas->entries);
+	struct repack_item *items = calloc(nentries ? nentries : 1, sizeof(*items));
+	return_val_if_fail(items != NULL, false);
+
+	uint32_t *pixels = calloc((size_t) width * height, sizeof(*pixels));
+	if (pixels == NULL)
+	{
+		free(items);
+		return false;
+	}
+
+	struct hopalong_atlas_entry *entry;
+	int i = 0;
+
+	wl_list_for_each(entry, &atlas->entries, link)
+		items[i++].entry = entry;
+
+	qsort(items, nentries, sizeof(*items), repack_item_cmp);
+
+	struct wl_array shelves;
+	wl_array_init(&shelves);
+
+	for (i = 0; i < nentries; i++)
+	{
+		struct hopalong_atlas_entry *entry = items[i].entry;
+		struct wlr_box *box = &entry->box;
+
+		if (!shelf_alloc(&shelves, width, height, entry->slot_width + ATLAS_PADDING * 2,
+				 entry->slot_height + ATLAS_PADDING * 2, &items[i].x, &items[i].y))
+		{
+			wl_array_release(&shelves);
+			free(pixels);
+			free(items);
+			return false;
+		}
+
+		items[i].x += ATLAS_PADDING;
+		items[i].y += ATLAS_PADDING;
+
+		copy_pixels(pixels, width, items[i].x, items[i].y,
+			atlas->pixels, atlas->width * 4, box->x, box->y, box->width, box->height);
+	}
+
+	for (i = 0; i < nentries; i++)
+	{
+		items[i].entry->box.x = items[i].x;
+		items[i].entry->box.y = items[i].y;
+	}
+
+	free(items);
+
+	free(atlas->pixels);
+	atlas->pixels = pixels;
+
+	wl_array_release(&atlas->shelves);
+	atlas->shelves = shelves;
+
+	/* a texture of the wrong size has to be created again */
+	if ((width != atlas->width || height != atlas->height) && atlas->texture != NULL)
+	{
+		wlr_texture_destroy(atlas->texture);
+		atlas->texture = NULL;
+	}
+
+	atlas->width = width;
+	atlas->height = height;
+	atlas->wasted_area = 0;
+
+	pixman_region32_union_rect(&atlas->dirty, &atlas->dirty, 0, 0, width, height);
+
+	wlr_log(WLR_DEBUG, "Repacked decoration atlas: %d images in %dx%d", nentries, width, height);
+
+	return true;
+}
+
+static bool
+hopalong_atlas_find_space(struct hopalong_atlas *atlas, int width, int height, int *x, int *y)
+{
+	if (shelf_alloc(&atlas->shelves, atlas->width, atlas->height, width, height, x, y))
+		return true;
+
+	/* try to reclaim space left by removed images first */
+	if (atlas->wasted_area > 0 && hopalong_atlas_repack(atlas, atlas->width, atlas->height) &&
+	    shelf_alloc(&atlas->shelves, atlas->width, atlas->height, width, height, x, y))
+		return true;
+
+	while (atlas->width * 2 <= atlas->max_size)
+	{
+		if (!hopalong_atlas_repack(atlas, atlas->width * 2, atlas->height * 2))
+			return false;
+
+		if (shelf_alloc(&atlas->shelves, atlas->width, atlas->height, width, height, x, y))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Destroys the tinted copies of an image, because it changed or is removed.
+ */
+static void
+forget_tinted(struct hopalong_atlas *atlas, const struct hopalong_atlas_entry *entry)
+{
+	struct hopalong_atlas_tinted *tinted, *next;
+	wl_list_for_each_safe(tinted, next, &atlas->tinted, link)
+	{
+		if (entry != NULL && tinted->entry != entry)
+			continue;
+
+		wl_list_remove(&tinted->link);
+		wlr_texture_destroy(tinted->texture);
+		free(tinted);
+	}
+}
+
+static struct hopalong_atlas_entry *
+hopalong_atlas_add_slot(struct hopalong_atlas *atlas, const void *data, int stride, int width, int height,
+	int slot_width, int slot_height)
+{
+	int padded_width = slot_width + ATLAS_PADDING * 2;
+	int padded_height = slot_height + ATLAS_PADDING * 2;
+
+	int x, y;
+	if (!hopalong_atlas_find_space(atlas, padded_width, padded_height, &x, &y))
+	{
+		wlr_log(WLR_ERROR, "No room for a %dx%d image in the decoration atlas", width, height);
+		return NULL;
+	}
+
+	struct hopalong_atlas_entry *entry = calloc(1, sizeof(*entry));
+	return_val_if_fail(entry != NULL, NULL);
+
+	entry->box = (struct wlr_box){
+		.x = x + ATLAS_PADDING,
+		.y = y + ATLAS_PADDING,
+		.width = width,
+		.height = height,
+	};
+	entry->slot_width = slot_width;
+	entry->slot_height = slot_height;
+
+	/* the space may have been used by an image which is gone now */
+	for (int row = y; row < y + padded_height; row++)
+		memset(atlas->pixels + row * atlas->width + x, 0, padded_width * 4);
+
+	copy_pixels(atlas->pixels, atlas->width, entry->box.x, entry->box.y, data, stride, 0, 0, width, height);
+
+	pixman_region32_union_rect(&atlas->dirty, &atlas->dirty, x, y, padded_width, padded_height);
+	atlas->used_area += padded_width * padded_height;
+
+	wl_list_insert(&atlas->entries, &entry->link);
+
+	return entry;
+}
+
+/*
+ * Copies an image in cairo's ARGB32 layout into the atlas.  Returns NULL if
+ * there is no room for it.
+ */
+struct hopalong_atlas_entry *
+hopalong_atlas_add(struct hopalong_atlas *atlas, const void *data, int stride, int width, int height)
+{
+	return_val_if_fail(atlas != NULL, NULL);
+	return_val_if_fail(data != NULL, NULL);
+	return_val_if_fail(width > 0 && height > 0, NULL);
+
+	return hopalong_atlas_add_slot(atlas, data, stride, width, height, width, height);
+}
+
+/*
+ * Replaces the image of an entry, which may be NULL.  As long as the new
+ * image fits into the space reserved for the old one, and does not leave
+ * most of it unused, it is overwritten in place; only that part of the
+ * atlas texture is uploaded again.  Otherwise the image moves to a new
+ * slot, rounded up so that small changes in size fit into it next time.
+ * Returns the entry for the new image, or NULL if there is no room for it,
+ * in which case the old entry is gone as well.
+ */
+struct hopalong_atlas_entry *
+hopalong_atlas_update(struct hopalong_atlas *atlas, struct hopalong_atlas_entry *entry,
+	const void *data, int stride, int width, int height)
+{
+	return_val_if_fail(atlas != NULL, NULL);
+	return_val_if_fail(data != NULL, NULL);
+	return_val_if_fail(width > 0 && height > 0, NULL);
+
+	if (entry != NULL && width <= entry->slot_width && height <= entry->slot_height &&
+	    width > entry->slot_width / 2)
+	{
+		struct wlr_box *box = &entry->box;
+
+		for (int row = box->y; row < box->y + entry->slot_height; row++)
+			memset(atlas->pixels + row * atlas->width + box->x, 0, entry->slot_width * 4);
+
+		copy_pixels(atlas->pixels, atlas->width, box->x, box->y, data, stride, 0, 0, width, height);
+		pixman_region32_union_rect(&atlas->dirty, &atlas->dirty, box->x, box->y,
+			entry->slot_width, entry->slot_height);
+
+		box->width = width;
+		box->height = height;
+
+		forget_tinted(atlas, entry);
+		return entry;
+	}
+
+	if (entry != NULL)
+		hopalong_atlas_remove(atlas, entry);
+
+	int slot_width = (width + ATLAS_SIZE_CLASS - 1) / ATLAS_SIZE_CLASS * ATLAS_SIZE_CLASS;
+
+	entry = hopalong_atlas_add_slot(atlas, data, stride, width, height, slot_width, height);
+	return entry;
+}
+
+/*
+ * Removes an image from the atlas.
+ */
+void
+hopalong_atlas_remove(struct hopalong_atlas *atlas, struct hopalong_atlas_entry *entry)
+{
+	return_if_fail(atlas != NULL);
+	return_if_fail(entry != NULL);
+
+	int area = (entry->slot_width + ATLAS_PADDING * 2) * (entry->slot_height + ATLAS_PADDING * 2);
+	atlas->used_area -= area;
+	atlas->wasted_area += area;
+
+	forget_tinted(atlas, entry);
+	wl_list_remove(&entry->link);
+	free(entry);
+
+	/* defragment once more of the atlas is wasted than used */
+	if (atlas->wasted_area > atlas->used_area && atlas->wasted_area > (atlas->width * atlas->height) / 4)
+		hopalong_atlas_repack(atlas, atlas->width, atlas->height);
+}
+
+/*
+ * Brings the atlas texture up to date.
+ */
+bool
+hopalong_atlas_upload(struct hopalong_atlas *atlas)
+{
+	return_val_if_fail(atlas != NULL, false);
+
+	if (atlas->texture == NULL)
+	{
+		atlas->texture = wlr_texture_from_pixels(atlas->renderer, WL_SHM_FORMAT_ARGB8888,
+			atlas->width * 4, atlas->width, atlas->height, atlas->pixels);
+		return_val_if_fail(atlas->texture != NULL, false);
+
+		pixman_region32_clear(&atlas->dirty);
+		return true;
+	}
+
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&atlas->dirty, &nrects);
+
+	for (int i = 0; i < nrects; i++)
+	{
+		pixman_box32_t *rect = &rects[i];
+
+		if (!wlr_texture_write_pixels(atlas->texture, atlas->width * 4,
+				rect->x2 - rect->x1, rect->y2 - rect->y1,
+				rect->x1, rect->y1, rect->x1, rect->y1, atlas->pixels))
+			return false;
+	}
+
+	pixman_region32_clear(&atlas->dirty);
+	return true;
+}
+
+/*
+ * Composites a copy of an image as a coverage mask for a color with pixman.
+ */
+static struct wlr_texture *
+create_tinted_texture(struct hopalong_atlas *atlas, const struct hopalong_atlas_entry *entry, const float tint[4])
+{
+	int width = entry->box.width;
+	int height = entry->box.height;
+
+	pixman_image_t *mask = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
+		atlas->width, atlas->height, atlas->pixels, atlas->width * 4);
+	pixman_image_t *dst = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height, NULL, 0);
+
+	pixman_color_t color = {
+		.red = tint[0] * 0xffff,
+		.green = tint[1] * 0xffff,
+		.blue = tint[2] * 0xffff,
+		.alpha = tint[3] * 0xffff,
+	};
+	pixman_image_t *src = pixman_image_create_solid_fill(&color);
+
+	struct wlr_texture *texture = NULL;
+
+	if (mask != NULL && dst != NULL && src != NULL)
+	{
+		pixman_image_composite32(PIXMAN_OP_SRC, src, mask, dst,
+			0, 0, entry->box.x, entry->box.y, 0, 0, width, height);
+
+		texture = wlr_texture_from_pixels(atlas->renderer, WL_SHM_FORMAT_ARGB8888,
+			pixman_image_get_stride(dst), width, height, pixman_image_get_data(dst));
+	}
+
+	if (src != NULL)
+		pixman_image_unref(src);
+	if (dst != NULL)
+		pixman_image_unref(dst);
+	if (mask != NULL)
+		pixman_image_unref(mask);
+
+	return texture;
+}
+
+/*
+ * Returns a texture of an image tinted with a color, for renderers which
+ * cannot tint while drawing.  The texture is made once and kept until the
+ * image is updated or removed, as titles are drawn far more often than
+ * they change.
+ */
+struct wlr_texture *
+hopalong_atlas_get_tinted(struct hopalong_atlas *atlas, const struct hopalong_atlas_entry *entry, const float tint[4])
+{
+	return_val_if_fail(atlas != NULL, NULL);
+	return_val_if_fail(entry != NULL, NULL);
+	return_val_if_fail(tint != NULL, NULL);
+
+	struct hopalong_atlas_tinted *tinted;
+	wl_list_for_each(tinted, &atlas->tinted, link)
+	{
+		if (tinted->entry == entry && !memcmp(tinted->tint, tint, sizeof(tinted->tint)))
+			return tinted->texture;
+	}
+
+	tinted = calloc(1, sizeof(*tinted));
+	return_val_if_fail(tinted != NULL, NULL);
+
+	tinted->texture = create_tinted_texture(atlas, entry, tint);
+	if (tinted->texture == NULL)
+	{
+		free(tinted);
+		return NULL;
+	}
+
+	tinted->entry = entry;
+	memcpy(tinted->tint, tint, sizeof(tinted->tint));
+	wl_list_insert(&atlas->tinted, &tinted->link);
+
+	return tinted->texture;
+}
+
+/*
+ * Returns the largest size the atlas texture may grow to on this renderer.
+ */
+static int
+get_max_size(struct wlr_renderer *renderer)
+{
+	if (!wlr_renderer_is_gles2(renderer))
+		return ATLAS_MAX_SIZE;
+
+	/* the renderer's context is only current while it renders */
+	struct wlr_egl *egl = wlr_gles2_renderer_get_egl(renderer);
+	if (!wlr_egl_make_current(egl))
+		return ATLAS_INITIAL_SIZE;
+
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+	wlr_egl_unset_current(egl);
+
+	if (max_size <= 0)
+		return ATLAS_INITIAL_SIZE;
+
+	return max_size < ATLAS_MAX_SIZE ? max_size : ATLAS_MAX_SIZE;
+}
+
+/*
+ * Creates an empty atlas.
+ */
+struct hopalong_atlas *
+hopalong_atlas_new(struct wlr_renderer *renderer)
+{
+	return_val_if_fail(renderer != NULL, NULL);
+
+	struct hopalong_atlas *atlas = calloc(1, sizeof(*atlas));
+	return_val_if_fail(atlas != NULL, NULL);
+
+	atlas->renderer = renderer;
+	atlas->max_size = get_max_size(renderer);
+	atlas->width = ATLAS_INITIAL_SIZE < atlas->max_size ? ATLAS_INITIAL_SIZE : atlas->max_size;
+	atlas->height = atlas->width;
+
+	atlas->pixels = calloc((size_t) atlas->width * atlas->height, sizeof(*atlas->pixels));
+	if (atlas->pixels == NULL)
+	{
+		free(atlas);
+		return NULL;
+	}
+
+	wl_list_init(&atlas->entries);
+	wl_list_init(&atlas->tinted);
+	wl_array_init(&atlas->shelves);
+	pixman_region32_init(&atlas->dirty);
+
+	/* solid rectangles sample the middle of this */
+	static const uint32_t white[9] = {
+		0xffffffff, 0xffffffff, 0xffffffff,
+		0xffffffff, 0xffffffff, 0xffffffff,
+		0xffffffff, 0xffffffff, 0xffffffff,
+	};
+
+	atlas->white = hopalong_atlas_add(atlas, white, 3 * 4, 3, 3);
+	if (atlas->white == NULL)
+	{
+		hopalong_atlas_destroy(atlas);
+		return NULL;
+	}
+
+	return atlas;
+}
+
+/*
+ * Destroys an atlas and all images in it.
+ */
+void
+hopalong_atlas_destroy(struct hopalong_atlas *atlas)
+{
+	return_if_fail(atlas != NULL);
+
+	forget_tinted(atlas, NULL);
+
+	struct hopalong_atlas_entry *entry, *next;
+	wl_list_for_each_safe(entry, next, &atlas->entries, link)
+	{
+		wl_list_remove(&entry->link);
+		free(entry);
+	}
+
+	if (atlas->texture != NULL)
+		wlr_texture_destroy(atlas->texture);
+
+	wl_array_release(&atlas->shelves);
+	pixman_region32_fini(&atlas->dirty);
+	free(atlas->pixels);
+	free(atlas);
+}
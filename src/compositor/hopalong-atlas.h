@@ -0,0 +1,96 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#ifndef HOPALONG_COMPOSITOR_ATLAS_H
+#define HOPALONG_COMPOSITOR_ATLAS_H
+
+#include <stdint.h>
+#include <pixman.h>
+#include <wayland-server-core.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/util/box.h>
+
+/*
+ * The atlas keeps all decoration images (button icons and title strips) in a
+ * single texture, so that they can be drawn together with the decoration
+ * rectangles.  Images are packed onto shelves; removed images leave holes
+ * which are reclaimed by repacking once enough space is wasted.
+ */
+struct hopalong_atlas_entry {
+	struct wl_list link;
+
+	/* position of the image in the atlas, in pixels */
+	struct wlr_box box;
+
+	/* the space reserved for the image, which it may grow into */
+	int slot_width, slot_height;
+};
+
+/*
+ * A copy of an image tinted with a color, for renderers which cannot tint
+ * images while drawing them.
+ */
+struct hopalong_atlas_tinted {
+	struct wl_list link;
+
+	const struct hopalong_atlas_entry *entry;
+	float tint[4];
+	struct wlr_texture *texture;
+};
+
+struct hopalong_atlas_shelf {
+	int y;
+	int height;
+	int used;
+};
+
+struct hopalong_atlas {
+	struct wlr_renderer *renderer;
+	struct wlr_texture *texture;
+
+	/* CPU copy of the atlas, in cairo's ARGB32 layout */
+	uint32_t *pixels;
+	int width, height;
+
+	/* the largest texture the renderer can take, or ATLAS_MAX_SIZE */
+	int max_size;
+
+	struct wl_list entries;
+	struct wl_array shelves;
+
+	/* areas of live and removed images, including padding */
+	int used_area;
+	int wasted_area;
+
+	/* parts of the atlas not yet uploaded to the texture */
+	pixman_region32_t dirty;
+
+	/* an opaque white texel for drawing solid rectangles */
+	struct hopalong_atlas_entry *white;
+
+	/* tinted copies, kept until their image changes or goes away */
+	struct wl_list tinted;
+};
+
+extern struct hopalong_atlas *hopalong_atlas_new(struct wlr_renderer *renderer);
+extern void hopalong_atlas_destroy(struct hopalong_atlas *atlas);
+extern struct hopalong_atlas_entry *hopalong_atlas_add(struct hopalong_atlas *atlas, const void *data, int stride, int width, int height);
+extern void hopalong_atlas_remove(struct hopalong_atlas *atlas, struct hopalong_atlas_entry *entry);
+extern struct hopalong_atlas_entry *hopalong_atlas_update(struct hopalong_atlas *atlas, struct hopalong_atlas_entry *entry,
+	const void *data, int stride, int width, int height);
+extern bool hopalong_atlas_upload(struct hopalong_atlas *atlas);
+extern struct wlr_texture *hopalong_atlas_get_tinted(struct hopalong_atlas *atlas, const struct hopalong_atlas_entry *entry,
+	const float tint[4]);
+
+#endif
@@ -0,0 +1,429 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "hopalong-macros.h"
+#include "hopalong-batch.h"
+#include "hopalong-output.h"
+
+#include <wlr/render/gles2.h>
+#include <wlr/types/wlr_matrix.h>
+#include <wlr/util/log.h>
+#include <GLES2/gl2.h>
+
+struct hopalong_batch_vertex {
+	float x, y;
+	float u, v;
+	float color[4];
+};
+
+static const GLchar batch_vertex_src[] =
+	"uniform mat3 proj;\n"
+	"attribute vec2 pos;\n"
+	"attribute vec2 uv;\n"
+	"attribute vec4 color;\n"
+	"varying vec2 v_uv;\n"
+	"varying vec4 v_color;\n"
+	"\n"
+	"void main() {\n"
+	"	gl_Position = vec4(proj * vec3(pos, 1.0), 1.0);\n"
+	"	v_uv = uv;\n"
+	"	v_color = color;\n"
+	"}\n";
+
+static const GLchar batch_fragment_src[] =
+	"precision mediump float;\n"
+	"uniform sampler2D tex;\n"
+	"varying vec2 v_uv;\n"
+	"varying vec4 v_color;\n"
+	"\n"
+	"void main() {\n"
+	"	gl_FragColor = texture2D(tex, v_uv) * v_color;\n"
+	"}\n";
+
+static const float white[4] = { 1.0, 1.0, 1.0, 1.0 };
+
+static GLuint
+compile_shader(GLenum type, const GLchar *src)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+
+	GLint ok;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (ok == GL_FALSE)
+	{
+		wlr_log(WLR_ERROR, "Failed to compile decoration batch shader");
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+static GLuint
+link_program(const GLchar *vert_src, const GLchar *frag_src)
+{
+	GLuint vert = compile_shader(GL_VERTEX_SHADER, vert_src);
+	if (!vert)
+		return 0;
+
+	GLuint frag = compile_shader(GL_FRAGMENT_SHADER, frag_src);
+	if (!frag)
+	{
+		glDeleteShader(vert);
+		return 0;
+	}
+
+	GLuint prog = glCreateProgram();
+	glAttachShader(prog, vert);
+	glAttachShader(prog, frag);
+	glLinkProgram(prog);
+
+	glDetachShader(prog, vert);
+	glDetachShader(prog, frag);
+	glDeleteShader(vert);
+	glDeleteShader(frag);
+
+	GLint ok;
+	glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+	if (ok == GL_FALSE)
+	{
+		wlr_log(WLR_ERROR, "Failed to link decoration batch shader");
+		glDeleteProgram(prog);
+		return 0;
+	}
+
+	return prog;
+}
+
+/*
+ * Sets up the GL side of the batch.  This has to happen while the renderer's
+ * context is current, so it is deferred until the first frame.  If anything
+ * goes wrong, decorations are drawn through the wlroots renderer instead.
+ */
+static void
+hopalong_batch_init_gl(struct hopalong_batch *batch)
+{
+	batch->initialized = true;
+
+	if (!wlr_renderer_is_gles2(batch->renderer))
+		return;
+
+	batch->program = link_program(batch_vertex_src, batch_fragment_src);
+	if (!batch->program)
+		return;
+
+	batch->proj_loc = glGetUniformLocation(batch->program, "proj");
+	batch->tex_loc = glGetUniformLocation(batch->program, "tex");
+	batch->pos_loc = glGetAttribLocation(batch->program, "pos");
+	batch->uv_loc = glGetAttribLocation(batch->program, "uv");
+	batch->color_loc = glGetAttribLocation(batch->program, "color");
+
+	glGenBuffers(1, &batch->vbo);
+
+	batch->usable = true;
+}
+
+/*
+ * Creates a batch for the given renderer.
+ */
+struct hopalong_batch *
+hopalong_batch_new(struct wlr_renderer *renderer, struct hopalong_atlas *atlas)
+{
+	return_val_if_fail(renderer != NULL, NULL);
+	return_val_if_fail(atlas != NULL, NULL);
+
+	struct hopalong_batch *batch = calloc(1, sizeof(*batch));
+	return_val_if_fail(batch != NULL, NULL);
+
+	batch->renderer = renderer;
+	batch->atlas = atlas;
+	wl_array_init(&batch->vertices);
+	pixman_region32_init(&batch->pending);
+
+	return batch;
+}
+
+/*
+ * Destroys a batch.  The GL objects go away along with the renderer's context.
+ */
+void
+hopalong_batch_destroy(struct hopalong_batch *batch)
+{
+	return_if_fail(batch != NULL);
+
+	wl_array_release(&batch->vertices);
+	pixman_region32_fini(&batch->pending);
+	free(batch);
+}
+
+/*
+ * Starts batching for an output.  Must be called between wlr_renderer_begin()
+ * and wlr_renderer_end().
+ */
+void
+hopalong_batch_begin(struct hopalong_batch *batch, struct wlr_output *output)
+{
+	return_if_fail(batch != NULL);
+	return_if_fail(output != NULL);
+
+	if (!batch->initialized)
+		hopalong_batch_init_gl(batch);
+
+	if (!hopalong_atlas_upload(batch->atlas))
+		wlr_log(WLR_ERROR, "Failed to upload decoration atlas");
+
+	batch->output = output;
+	batch->vertices.size = 0;
+	pixman_region32_clear(&batch->pending);
+
+	/* same projection as the renderer uses for the output's buffer */
+	float projection[9];
+	wlr_matrix_projection(projection, output->width, output->height, WL_OUTPUT_TRANSFORM_FLIPPED_180);
+	wlr_matrix_multiply(batch->projection, projection, output->transform_matrix);
+	wlr_matrix_transpose(batch->projection, batch->projection);
+}
+
+static bool
+add_vertex(struct hopalong_batch *batch, float x, float y, float u, float v, const float color[4])
+{
+	struct hopalong_batch_vertex *vertex = wl_array_add(&batch->vertices, sizeof(*vertex));
+	return_val_if_fail(vertex != NULL, false);
+
+	vertex->x = x;
+	vertex->y = y;
+	vertex->u = u;
+	vertex->v = v;
+
+	for (size_t i = 0; i < 4; i++)
+		vertex->color[i] = color[i];
+
+	return true;
+}
+
+/*
+ * Adds a quad covering rect, sampling the atlas between (u1, v1) and (u2, v2).
+ */
+static void
+add_quad(struct hopalong_batch *batch, const pixman_box32_t *rect,
+	float u1, float v1, float u2, float v2, const float color[4])
+{
+	/* two triangles per quad */
+	if (!add_vertex(batch, rect->x1, rect->y1, u1, v1, color) ||
+	    !add_vertex(batch, rect->x2, rect->y1, u2, v1, color) ||
+	    !add_vertex(batch, rect->x1, rect->y2, u1, v2, color) ||
+	    !add_vertex(batch, rect->x2, rect->y1, u2, v1, color) ||
+	    !add_vertex(batch, rect->x2, rect->y2, u2, v2, color) ||
+	    !add_vertex(batch, rect->x1, rect->y2, u1, v2, color))
+		return;
+}
+
+/*
+ * Adds a solid rectangle, in output-local buffer coordinates, to the batch.
+ * Only the part of it within damage is drawn.
+ */
+void
+hopalong_batch_add_rect(struct hopalong_batch *batch, pixman_region32_t *damage, const struct wlr_box *box, const float color[4])
+{
+	return_if_fail(batch != NULL);
+	return_if_fail(batch->output != NULL);
+
+	pixman_region32_t region;
+	pixman_region32_init(&region);
+	pixman_region32_intersect_rect(&region, damage, box->x, box->y, box->width, box->height);
+
+	/* the middle of the white texel */
+	struct hopalong_atlas *atlas = batch->atlas;
+	float u = (atlas->white->box.x + atlas->white->box.width / 2.0) / atlas->width;
+	float v = (atlas->white->box.y + atlas->white->box.height / 2.0) / atlas->height;
+
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+
+	for (int i = 0; i < nrects; i++)
+	{
+		if (!batch->usable)
+		{
+			hopalong_output_scissor(batch->output, &rects[i]);
+			wlr_render_rect(batch->renderer, box, color, batch->output->transform_matrix);
+			continue;
+		}
+
+		add_quad(batch, &rects[i], u, v, u, v, color);
+	}
+
+	if (batch->usable)
+		pixman_region32_union(&batch->pending, &batch->pending, &region);
+
+	pixman_region32_fini(&region);
+}
+
+/*
+ * Adds an image from the atlas, stretched over box, to the batch.  Only the
+ * part of it within damage is drawn.  If tint is given, the image is used as
+ * a coverage mask for that color.
+ */
+void
+hopalong_batch_add_image(struct hopalong_batch *batch, pixman_region32_t *damage, const struct wlr_box *box,
+	const struct hopalong_atlas_entry *image, const float tint[4])
+{
+	return_if_fail(batch != NULL);
+	return_if_fail(batch->output != NULL);
+	return_if_fail(image != NULL);
+
+	struct hopalong_atlas *atlas = batch->atlas;
+	if (atlas->texture == NULL || box->width <= 0 || box->height <= 0)
+		return;
+
+	if (tint == NULL)
+		tint = white;
+
+	/* without the batch shader, images cannot be tinted on the GPU */
+	struct wlr_texture *tinted = NULL;
+	if (!batch->usable && tint != white)
+	{
+		tinted = hopalong_atlas_get_tinted(atlas, image, tint);
+		if (tinted == NULL)
+			return;
+	}
+
+	pixman_region32_t region;
+	pixman_region32_init(&region);
+	pixman_region32_intersect_rect(&region, damage, box->x, box->y, box->width, box->height);
+
+	float sx = (float) image->box.width / box->width;
+	float sy = (float) image->box.height / box->height;
+
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&region, &nrects);
+
+	for (int i = 0; i < nrects; i++)
+	{
+		pixman_box32_t *rect = &rects[i];
+
+		if (!batch->usable)
+		{
+			struct wlr_fbox src_box = {
+				.x = tinted != NULL ? 0 : image->box.x,
+				.y = tinted != NULL ? 0 : image->box.y,
+				.width = image->box.width,
+				.height = image->box.height,
+			};
+
+			float matrix[9];
+			wlr_matrix_project_box(matrix, box, WL_OUTPUT_TRANSFORM_NORMAL, 0.0, batch->output->transform_matrix);
+
+			hopalong_output_scissor(batch->output, rect);
+			wlr_render_subtexture_with_matrix(batch->renderer, tinted != NULL ? tinted : atlas->texture,
+				&src_box, matrix, 1.0);
+			continue;
+		}
+
+		/* map the clipped rectangle back into the image */
+		float u1 = (image->box.x + (rect->x1 - box->x) * sx) / atlas->width;
+		float v1 = (image->box.y + (rect->y1 - box->y) * sy) / atlas->height;
+		float u2 = (image->box.x + (rect->x2 - box->x) * sx) / atlas->width;
+		float v2 = (image->box.y + (rect->y2 - box->y) * sy) / atlas->height;
+
+		add_quad(batch, rect, u1, v1, u2, v2, tint);
+	}
+
+	if (batch->usable)
+		pixman_region32_union(&batch->pending, &batch->pending, &region);
+
+	pixman_region32_fini(&region);
+}
+
+/*
+ * Draws the pending quads if box, in output-local buffer coordinates, would
+ * be drawn over any of them.  Anything drawn outside of the batch has to
+ * call this first, so that it ends up on top of the quads batched before it.
+ */
+void
+hopalong_batch_flush_if_overlaps(struct hopalong_batch *batch, const struct wlr_box *box)
+{
+	return_if_fail(batch != NULL);
+
+	if (!pixman_region32_not_empty(&batch->pending))
+		return;
+
+	pixman_box32_t rect = {
+		.x1 = box->x,
+		.y1 = box->y,
+		.x2 = box->x + box->width,
+		.y2 = box->y + box->height,
+	};
+
+	if (pixman_region32_contains_rectangle(&batch->pending, &rect) != PIXMAN_REGION_OUT)
+		hopalong_batch_flush(batch);
+}
+
+/*
+ * Draws all pending quads in a single draw call.
+ */
+void
+hopalong_batch_flush(struct hopalong_batch *batch)
+{
+	return_if_fail(batch != NULL);
+
+	size_t nvertices = batch->vertices.size / sizeof(struct hopalong_batch_vertex);
+	if (!batch->usable || nvertices == 0 || batch->atlas->texture == NULL)
+		return;
+
+	/* quads are clipped already */
+	wlr_renderer_scissor(batch->renderer, NULL);
+
+	struct wlr_gles2_texture_attribs attribs;
+	wlr_gles2_texture_get_attribs(batch->atlas->texture, &attribs);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(attribs.target, attribs.tex);
+	glTexParameteri(attribs.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(attribs.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glUseProgram(batch->program);
+	glUniformMatrix3fv(batch->proj_loc, 1, GL_FALSE, batch->projection);
+	glUniform1i(batch->tex_loc, 0);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	glBufferData(GL_ARRAY_BUFFER, batch->vertices.size, batch->vertices.data, GL_STREAM_DRAW);
+
+	glVertexAttribPointer(batch->pos_loc, 2, GL_FLOAT, GL_FALSE, sizeof(struct hopalong_batch_vertex),
+		(void *) offsetof(struct hopalong_batch_vertex, x));
+	glVertexAttribPointer(batch->uv_loc, 2, GL_FLOAT, GL_FALSE, sizeof(struct hopalong_batch_vertex),
+		(void *) offsetof(struct hopalong_batch_vertex, u));
+	glVertexAttribPointer(batch->color_loc, 4, GL_FLOAT, GL_FALSE, sizeof(struct hopalong_batch_vertex),
+		(void *) offsetof(struct hopalong_batch_vertex, color));
+
+	glEnableVertexAttribArray(batch->pos_loc);
+	glEnableVertexAttribArray(batch->uv_loc);
+	glEnableVertexAttribArray(batch->color_loc);
+
+	glDrawArrays(GL_TRIANGLES, 0, nvertices);
+
+	glDisableVertexAttribArray(batch->pos_loc);
+	glDisableVertexAttribArray(batch->uv_loc);
+	glDisableVertexAttribArray(batch->color_loc);
+
+	/* wlroots passes its vertices from client memory */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	batch->vertices.size = 0;
+	pixman_region32_clear(&batch->pending);
+}
@@ -0,0 +1,63 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#ifndef HOPALONG_COMPOSITOR_BATCH_H
+#define HOPALONG_COMPOSITOR_BATCH_H
+
+#include <pixman.h>
+#include <wayland-server-core.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/box.h>
+
+#include "hopalong-atlas.h"
+
+/*
+ * The batch collects the quads making up server-side decorations, so that
+ * the decorations of many views can be drawn with a single draw call.
+ * Solid rectangles and images both sample the decoration atlas.
+ * Quads are clipped against the damage of the view they belong to when they
+ * are added, so no scissoring is needed when drawing them.
+ */
+struct hopalong_batch {
+	struct wlr_renderer *renderer;
+	struct wlr_output *output;
+	struct hopalong_atlas *atlas;
+
+	/* pending vertices, and the area they cover in output-local coordinates */
+	struct wl_array vertices;
+	pixman_region32_t pending;
+
+	/* GL state, set up on first use while the renderer is current */
+	bool initialized;
+	bool usable;
+	unsigned int program;
+	unsigned int vbo;
+	int proj_loc;
+	int tex_loc;
+	int pos_loc;
+	int uv_loc;
+	int color_loc;
+
+	float projection[9];
+};
+
+extern struct hopalong_batch *hopalong_batch_new(struct wlr_renderer *renderer, struct hopalong_atlas *atlas);
+extern void hopalong_batch_destroy(struct hopalong_batch *batch);
+extern void hopalong_batch_begin(struct hopalong_batch *batch, struct wlr_output *output);
+extern void hopalong_batch_add_rect(struct hopalong_batch *batch, pixman_region32_t *damage, const struct wlr_box *box, const float color[4]);
+extern void hopalong_batch_add_image(struct hopalong_batch *batch, pixman_region32_t *damage, const struct wlr_box *box, const struct hopalong_atlas_entry *image, const float tint[4]);
+extern void hopalong_batch_flush_if_overlaps(struct hopalong_batch *batch, const struct wlr_box *box);
+extern void hopalong_batch_flush(struct hopalong_batch *batch);
+
+#endif
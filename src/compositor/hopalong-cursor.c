@@ -26,13 +26,137 @@ static const char * cursor_images[HOPALONG_VIEW_FRAME_AREA_COUNT] = {
 	[HOPALONG_VIEW_FRAME_AREA_CLOSE]	= "left_ptr",
 };
 
+static void
+forget_cursor_owner(struct hopalong_server *server)
+{
+	if (server->cursor_surface != NULL)
+	{
+		wl_list_remove(&server->cursor_surface_destroy.link);
+		server->cursor_surface = NULL;
+	}
+
+	if (server->cursor_client != NULL)
+	{
+		wl_list_remove(&server->cursor_client_destroy.link);
+		server->cursor_client = NULL;
+	}
+
+	server->cursor_owner = HOPALONG_CURSOR_OWNER_NONE;
+}
+
+static void
+cursor_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct hopalong_server *server = wl_container_of(listener, server, cursor_surface_destroy);
+
+	forget_cursor_owner(server);
+}
+
+/*
+ * A new client may get the same address, and its cursor would then be
+ * mistaken for the one already shown.
+ */
+static void
+cursor_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct hopalong_server *server = wl_container_of(listener, server, cursor_client_destroy);
+
+	forget_cursor_owner(server);
+}
+
+/*
+ * Sets the cursor to an xcursor image, unless it is already showing it.
+ * Setting an image uploads it to every output's cursor plane, or damages
+ * the outputs when using software cursors, so doing it on every motion
+ * event would be wasteful.
+ */
+void
+hopalong_cursor_set_image(struct hopalong_server *server, const char *name)
+{
+	return_if_fail(server != NULL);
+	return_if_fail(name != NULL);
+
+	if (server->cursor_owner == HOPALONG_CURSOR_OWNER_COMPOSITOR && server->cursor_image == name)
+		return;
+
+	forget_cursor_owner(server);
+
+	wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, name, server->cursor);
+	server->cursor_owner = HOPALONG_CURSOR_OWNER_COMPOSITOR;
+	server->cursor_image = name;
+}
+
+/*
+ * Sets the cursor to a surface of the client with pointer focus, unless it
+ * is already showing it.  Clients tend to set the same cursor again on
+ * every pointer enter.
+ */
+void
+hopalong_cursor_set_surface(struct hopalong_server *server, struct wlr_seat_client *client,
+	struct wlr_surface *surface, int32_t hotspot_x, int32_t hotspot_y)
+{
+	return_if_fail(server != NULL);
+	return_if_fail(client != NULL);
+
+	if (server->cursor_owner == HOPALONG_CURSOR_OWNER_CLIENT && server->cursor_client == client &&
+	    server->cursor_surface == surface &&
+	    server->cursor_hotspot_x == hotspot_x && server->cursor_hotspot_y == hotspot_y)
+		return;
+
+	forget_cursor_owner(server);
+
+	wlr_cursor_set_surface(server->cursor, surface, hotspot_x, hotspot_y);
+
+	server->cursor_owner = HOPALONG_CURSOR_OWNER_CLIENT;
+	server->cursor_client = client;
+	server->cursor_image = NULL;
+	server->cursor_hotspot_x = hotspot_x;
+	server->cursor_hotspot_y = hotspot_y;
+	wl_signal_add(&client->events.destroy, &server->cursor_client_destroy);
+
+	/* a hidden cursor has no surface to watch */
+	if (surface != NULL)
+	{
+		server->cursor_surface = surface;
+		wl_signal_add(&surface->events.destroy, &server->cursor_surface_destroy);
+	}
+}
+
+/*
+ * Forgets what the cursor shows, so that the next image is set again, e.g.
+ * because an output without a cursor image was added.
+ */
+void
+hopalong_cursor_invalidate(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	forget_cursor_owner(server);
+	server->cursor_image = NULL;
+}
+
+/*
+ * Loads the cursor theme at an output scale, unless it is loaded already.
+ */
+void
+hopalong_cursor_load_scale(struct hopalong_server *server, float scale)
+{
+	return_if_fail(server != NULL);
+	return_if_fail(server->cursor_mgr != NULL);
+
+	if (!wlr_xcursor_manager_load(server->cursor_mgr, scale))
+		wlr_log(WLR_ERROR, "Failed to load cursor theme at scale %f", scale);
+}
+
 static void
 process_cursor_move(struct hopalong_server *server, uint32_t time)
 {
 	server->grabbed_view->x = server->cursor->x - server->grab_x;
 	server->grabbed_view->y = server->cursor->y - server->grab_y;
 
-	wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, "grabbing", server->cursor);
+	hopalong_view_damage_whole(server->grabbed_view);
+
+	hopalong_cursor_set_image(server, "grabbing");
 }
 
 static void
@@ -77,14 +201,15 @@ process_cursor_resize(struct hopalong_server *server, uint32_t time)
 			new_right = new_left + 1;
         }
 
-	struct wlr_box geo_box;
-	hopalong_view_get_geometry(view, &geo_box);
-	view->x = new_left - geo_box.x;
-	view->y = new_top - geo_box.y;
+	struct wlr_box box = {
+		.x = new_left,
+		.y = new_top,
+		.width = new_right - new_left,
+		.height = new_bottom - new_top,
+	};
 
-	int new_width = new_right - new_left;
-	int new_height = new_bottom - new_top;
-	hopalong_view_set_size(view, new_width, new_height);
+	/* the view only moves once the client has caught up */
+	hopalong_view_resize(view, &box, server->resize_edges);
 }
 
 static void
@@ -108,11 +233,6 @@ process_cursor_motion(struct hopalong_server *server, uint32_t time)
 	struct hopalong_view *view = hopalong_shell_desktop_view_at(server,
 		server->cursor->x, server->cursor->y, &surface, &sx, &sy);
 
-	if (view == NULL || view->frame_area == -1 || surface != NULL)
-		wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, "left_ptr", server->cursor);
-	else if (view->frame_area != -1 && view->frame_area < HOPALONG_VIEW_FRAME_AREA_COUNT)
-		wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, cursor_images[view->frame_area], server->cursor);
-
 	if (surface != NULL)
 	{
 		bool focus_changed = seat->pointer_state.focused_surface != surface;
@@ -129,6 +249,84 @@ process_cursor_motion(struct hopalong_server *server, uint32_t time)
 	}
 	else
 		wlr_seat_pointer_clear_focus(seat);
+
+	/* a client keeps its own cursor while the pointer stays over it */
+	if (surface != NULL && server->cursor_owner == HOPALONG_CURSOR_OWNER_CLIENT &&
+	    server->cursor_client == seat->pointer_state.focused_client)
+		return;
+
+	if (surface == NULL && view != NULL && view->frame_area != -1 && view->frame_area < HOPALONG_VIEW_FRAME_AREA_COUNT)
+		hopalong_cursor_set_image(server, cursor_images[view->frame_area]);
+	else
+		hopalong_cursor_set_image(server, "left_ptr");
+}
+
+/*
+ * Passes on pointer motion which was held back, with the timestamp of the
+ * last event it stands for.  This is done once per output frame, and before
+ * any other pointer event so that clients see them in order.
+ */
+void
+hopalong_cursor_flush_motion(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	if (!server->motion_pending)
+		return;
+
+	server->motion_pending = false;
+
+	process_cursor_motion(server, server->motion_time_msec);
+	wlr_seat_pointer_notify_frame(server->seat);
+}
+
+/*
+ * Tells whether the pointer left the surface it was last found over, as far
+ * as clients using relative pointer motion are concerned.  This is only
+ * known for surfaces with a simple shape; elsewhere, relative motion goes
+ * to the surface which had focus on the last frame.
+ */
+static bool
+pointer_focus_changes(struct hopalong_server *server)
+{
+	if (server->relative_pointer_mgr == NULL || wl_list_empty(&server->relative_pointer_mgr->relative_pointers))
+		return false;
+
+	return hopalong_shell_left_last_hit(server, server->cursor->x, server->cursor->y);
+}
+
+/*
+ * High polling rate mice send several motion events per refresh, and each
+ * would be hit tested and sent to the client under the pointer.  Outside of
+ * grabs, the cursor still moves with every event, but the rest is done once
+ * on the next frame of the output the cursor is on, with the timestamp of
+ * the last event only.  Grabs are handled right away, they move and resize
+ * views.
+ */
+static void
+handle_cursor_motion(struct hopalong_server *server, uint32_t time)
+{
+	struct wlr_output *wlr_output = wlr_output_layout_output_at(server->output_layout,
+		server->cursor->x, server->cursor->y);
+
+	if (server->cursor_mode != HOPALONG_CURSOR_PASSTHROUGH || wlr_output == NULL)
+	{
+		hopalong_cursor_flush_motion(server);
+		process_cursor_motion(server, time);
+		return;
+	}
+
+	server->motion_pending = true;
+	server->motion_time_msec = time;
+
+	/* relative motion is sent right away, so focus should follow soon */
+	if (pointer_focus_changes(server))
+	{
+		hopalong_cursor_flush_motion(server);
+		return;
+	}
+
+	wlr_output_schedule_frame(wlr_output);
 }
 
 static void
@@ -137,8 +335,14 @@ cursor_motion(struct wl_listener *listener, void *data)
 	struct hopalong_server *server = wl_container_of(listener, server, cursor_motion);
 	struct wlr_event_pointer_motion *event = data;
 
+	/* clients using relative motion, e.g. games, want every sample */
+	if (server->relative_pointer_mgr != NULL)
+		wlr_relative_pointer_manager_v1_send_relative_motion(server->relative_pointer_mgr, server->seat,
+			(uint64_t) event->time_msec * 1000, event->delta_x, event->delta_y,
+			event->unaccel_dx, event->unaccel_dy);
+
 	wlr_cursor_move(server->cursor, event->device, event->delta_x, event->delta_y);
-	process_cursor_motion(server, event->time_msec);
+	handle_cursor_motion(server, event->time_msec);
 }
 
 static void
@@ -148,7 +352,7 @@ cursor_motion_absolute(struct wl_listener *listener, void *data)
 	struct wlr_event_pointer_motion_absolute *event = data;
 
 	wlr_cursor_warp_absolute(server->cursor, event->device, event->x, event->y);
-	process_cursor_motion(server, event->time_msec);
+	handle_cursor_motion(server, event->time_msec);
 }
 
 static void
@@ -157,6 +361,8 @@ cursor_button(struct wl_listener *listener, void *data)
 	struct hopalong_server *server = wl_container_of(listener, server, cursor_button);
 	struct wlr_event_pointer_button *event = data;
 
+	hopalong_cursor_flush_motion(server);
+
 	wlr_seat_pointer_notify_button(server->seat, event->time_msec, event->button, event->state);
 
 	double sx, sy;
@@ -165,9 +371,11 @@ cursor_button(struct wl_listener *listener, void *data)
 
 	if (event->state == WLR_BUTTON_RELEASED)
 	{
-		server->cursor_mode = HOPALONG_CURSOR_PASSTHROUGH;
+		/* only grabs change the cursor, clients keep theirs across clicks */
+		if (server->cursor_mode != HOPALONG_CURSOR_PASSTHROUGH)
+			hopalong_cursor_set_image(server, "left_ptr");
 
-		wlr_xcursor_manager_set_cursor_image(server->cursor_mgr, "left_ptr", server->cursor);
+		server->cursor_mode = HOPALONG_CURSOR_PASSTHROUGH;
 
 		server->resize_edges = WLR_EDGE_NONE;
 	}
@@ -232,6 +440,8 @@ cursor_axis(struct wl_listener *listener, void *data)
 	struct hopalong_server *server = wl_container_of(listener, server, cursor_axis);
 	struct wlr_event_pointer_axis *event = data;
 
+	hopalong_cursor_flush_motion(server);
+
 	wlr_seat_pointer_notify_axis(server->seat, event->time_msec, event->orientation,
 		event->delta, event->delta_discrete, event->source);
 }
@@ -240,6 +450,11 @@ static void
 cursor_frame(struct wl_listener *listener, void *data)
 {
 	struct hopalong_server *server = wl_container_of(listener, server, cursor_frame);
+
+	/* held back motion is sent with a frame of its own */
+	if (server->motion_pending)
+		return;
+
 	wlr_seat_pointer_notify_frame(server->seat);
 }
 
@@ -249,9 +464,10 @@ hopalong_cursor_setup(struct hopalong_server *server)
 	server->cursor = wlr_cursor_create();
 	wlr_cursor_attach_output_layout(server->cursor, server->output_layout);
 
+	/* themes are loaded for each scale once an output uses it */
 	server->cursor_mgr = wlr_xcursor_manager_create("breeze_cursors", 48);
-	wlr_xcursor_manager_load(server->cursor_mgr, 1);
-	wlr_xcursor_manager_load(server->cursor_mgr, 2);
+	server->cursor_surface_destroy.notify = cursor_surface_destroy;
+	server->cursor_client_destroy.notify = cursor_client_destroy;
 
 	server->cursor_motion.notify = cursor_motion;
 	wl_signal_add(&server->cursor->events.motion, &server->cursor_motion);
@@ -272,6 +488,8 @@ hopalong_cursor_setup(struct hopalong_server *server)
 void
 hopalong_cursor_teardown(struct hopalong_server *server)
 {
+	forget_cursor_owner(server);
+
 	if (server->cursor_mgr)
 		wlr_xcursor_manager_destroy(server->cursor_mgr);
 
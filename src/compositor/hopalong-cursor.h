@@ -38,5 +38,11 @@ struct hopalong_server;
 
 extern void hopalong_cursor_setup(struct hopalong_server *server);
 extern void hopalong_cursor_teardown(struct hopalong_server *server);
+extern void hopalong_cursor_set_image(struct hopalong_server *server, const char *name);
+extern void hopalong_cursor_set_surface(struct hopalong_server *server, struct wlr_seat_client *client,
+	struct wlr_surface *surface, int32_t hotspot_x, int32_t hotspot_y);
+extern void hopalong_cursor_invalidate(struct hopalong_server *server);
+extern void hopalong_cursor_load_scale(struct hopalong_server *server, float scale);
+extern void hopalong_cursor_flush_motion(struct hopalong_server *server);
 
 #endif
@@ -84,3 +84,212 @@ void
 hopalong_decoration_teardown(struct hopalong_server *server)
 {
 }
+
+#define BORDER_HITBOX_THICKNESS		(4)
+
+/* titles are rendered for title bar widths rounded down to this */
+#define TITLE_WIDTH_STEP		(32)
+
+static void
+add_quad(struct hopalong_decoration *deco, const struct wlr_box *box, const float *color, enum hopalong_decoration_image image)
+{
+	return_if_fail(deco->nquads < HOPALONG_DECORATION_MAX_QUADS);
+
+	if (color == NULL && image == HOPALONG_DECORATION_IMAGE_NONE)
+		return;
+
+	deco->quads[deco->nquads++] = (struct hopalong_decoration_quad){
+		.box = *box,
+		.color = color,
+		.image = image,
+	};
+}
+
+/*
+ * Lays out the server-side decorations of a view, relative to its position.
+ * Nothing is done if the cached layout is still current.
+ */
+bool
+hopalong_decoration_update(struct hopalong_view *view)
+{
+	return_val_if_fail(view != NULL, false);
+
+	const struct hopalong_style *style = view->server->style;
+	return_val_if_fail(style != NULL, false);
+
+	struct wlr_box geo;
+	if (!hopalong_view_get_geometry(view, &geo))
+		return false;
+
+	struct hopalong_decoration *deco = &view->decoration;
+
+	if (deco->valid && deco->width == geo.width && deco->height == geo.height &&
+	    deco->activated == view->activated && deco->hide_title_bar == view->hide_title_bar)
+		return true;
+
+	*deco = (struct hopalong_decoration){
+		.valid = true,
+		.width = geo.width,
+		.height = geo.height,
+		.activated = view->activated,
+		.hide_title_bar = view->hide_title_bar,
+	};
+
+	struct wlr_box *areas = deco->frame_areas;
+	struct wlr_box base_box = {
+		.x = -style->border_thickness,
+		.y = 1 - style->border_thickness,
+		.width = geo.width + (style->border_thickness * 2),
+		.height = geo.height + (style->border_thickness * 2) - 1,
+	};
+
+	int title_bar_offset = (view->hide_title_bar ? 0 : style->title_bar_height) + style->border_thickness;
+
+	/* borders, starting with top */
+	areas[HOPALONG_VIEW_FRAME_AREA_TOP] = (struct wlr_box){
+		.x = base_box.x,
+		.y = base_box.y - title_bar_offset,
+		.width = base_box.width,
+		.height = title_bar_offset,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_TOP], style->border, HOPALONG_DECORATION_IMAGE_NONE);
+	areas[HOPALONG_VIEW_FRAME_AREA_TOP].y -= BORDER_HITBOX_THICKNESS;
+	areas[HOPALONG_VIEW_FRAME_AREA_TOP].height += BORDER_HITBOX_THICKNESS;
+
+	/* bottom border */
+	areas[HOPALONG_VIEW_FRAME_AREA_BOTTOM] = (struct wlr_box){
+		.x = base_box.x,
+		.y = base_box.y + base_box.height - style->border_thickness,
+		.width = base_box.width,
+		.height = style->border_thickness,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_BOTTOM], style->border, HOPALONG_DECORATION_IMAGE_NONE);
+	areas[HOPALONG_VIEW_FRAME_AREA_BOTTOM].height += BORDER_HITBOX_THICKNESS;
+
+	/* left border */
+	areas[HOPALONG_VIEW_FRAME_AREA_LEFT] = (struct wlr_box){
+		.x = base_box.x,
+		.y = base_box.y,
+		.width = style->border_thickness,
+		.height = base_box.height,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_LEFT], style->border, HOPALONG_DECORATION_IMAGE_NONE);
+	areas[HOPALONG_VIEW_FRAME_AREA_LEFT].x -= BORDER_HITBOX_THICKNESS;
+	areas[HOPALONG_VIEW_FRAME_AREA_LEFT].width += BORDER_HITBOX_THICKNESS;
+
+	/* right border */
+	areas[HOPALONG_VIEW_FRAME_AREA_RIGHT] = (struct wlr_box){
+		.x = base_box.x + base_box.width - style->border_thickness,
+		.y = base_box.y,
+		.width = style->border_thickness,
+		.height = base_box.height,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_RIGHT], style->border, HOPALONG_DECORATION_IMAGE_NONE);
+	areas[HOPALONG_VIEW_FRAME_AREA_RIGHT].width += BORDER_HITBOX_THICKNESS;
+
+	/* title bar */
+	if (view->hide_title_bar)
+		return true;
+
+	bool activated = view->activated;
+
+	areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR] = (struct wlr_box){
+		.x = base_box.x + style->border_thickness,
+		.y = base_box.y - style->title_bar_height,
+		.width = base_box.width - (style->border_thickness * 2),
+		.height = style->title_bar_height + 1,
+	};
+
+	/* the title bar hit box reaches into the surface, which is drawn over it
+	 * anyway.  leaving that part out lets the surface go on top of a pending
+	 * decoration batch without having to flush it first.
+	 */
+	struct wlr_box title_bar = areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR];
+	int surface_top = base_box.y + style->border_thickness - 1;
+	if (title_bar.y + title_bar.height > surface_top)
+		title_bar.height = surface_top - title_bar.y;
+
+	add_quad(deco, &title_bar, activated ? style->title_bar_bg : style->title_bar_bg_inactive, HOPALONG_DECORATION_IMAGE_NONE);
+
+	/* the title was ellipsized for a title bar of a different width */
+	int title_width = hopalong_decoration_get_title_width(view);
+	if (title_width < view->title_max_width ||
+	    (view->title_ellipsized && title_width > view->title_max_width))
+		hopalong_view_set_title_dirty(view);
+
+	/* title bar text, large enough for the title at any output scale */
+	if (view->title_box.width > 0 && view->title_box.height > 0)
+	{
+		struct wlr_box box = {
+			.x = areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].x + style->title_bar_padding,
+			.y = areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].y + style->title_bar_padding,
+			.width = view->title_box.width,
+			.height = view->title_box.height,
+		};
+
+		add_quad(deco, &box, activated ? style->title_bar_fg : style->title_bar_fg_inactive,
+			HOPALONG_DECORATION_IMAGE_TITLE);
+	}
+
+	/* buttons */
+	areas[HOPALONG_VIEW_FRAME_AREA_CLOSE] = (struct wlr_box){
+		.x = areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].x + (base_box.width - style->border_thickness - (style->title_bar_padding * 3)),
+		.y = areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].y + style->title_bar_padding,
+		.width = 16,
+		.height = 16,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_CLOSE], NULL, HOPALONG_DECORATION_IMAGE_CLOSE);
+
+	areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE] = (struct wlr_box){
+		.x = areas[HOPALONG_VIEW_FRAME_AREA_CLOSE].x - (16 + style->title_bar_padding),
+		.y = areas[HOPALONG_VIEW_FRAME_AREA_CLOSE].y,
+		.width = 16,
+		.height = 16,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE], NULL, HOPALONG_DECORATION_IMAGE_MAXIMIZE);
+
+	areas[HOPALONG_VIEW_FRAME_AREA_MINIMIZE] = (struct wlr_box){
+		.x = areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE].x - (16 + style->title_bar_padding),
+		.y = areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE].y,
+		.width = 16,
+		.height = 16,
+	};
+	add_quad(deco, &areas[HOPALONG_VIEW_FRAME_AREA_MINIMIZE], NULL, HOPALONG_DECORATION_IMAGE_MINIMIZE);
+
+	return true;
+}
+
+/*
+ * Returns the width the title of a view may take up between the left edge
+ * of its title bar and the buttons, in layout coordinates.  It is rounded
+ * down, so that resizing a view does not render its title on every frame.
+ */
+int
+hopalong_decoration_get_title_width(struct hopalong_view *view)
+{
+	return_val_if_fail(view != NULL, 0);
+
+	const struct hopalong_style *style = view->server->style;
+
+	struct wlr_box geo;
+	if (!hopalong_view_get_geometry(view, &geo))
+		return 0;
+
+	int width = geo.width + style->border_thickness - (style->title_bar_padding * 7) - (16 * 2);
+	if (width <= 0)
+		return 0;
+
+	return width - (width % TITLE_WIDTH_STEP);
+}
+
+/*
+ * Forces the decorations of a view to be laid out again, e.g. because its
+ * title was rendered again.
+ */
+void
+hopalong_decoration_invalidate(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
+
+	view->decoration.valid = false;
+}
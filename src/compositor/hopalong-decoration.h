@@ -33,7 +33,14 @@
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 
+struct hopalong_server;
+struct hopalong_view;
+
 extern void hopalong_decoration_setup(struct hopalong_server *server);
 extern void hopalong_decoration_teardown(struct hopalong_server *server);
 
+extern bool hopalong_decoration_update(struct hopalong_view *view);
+extern void hopalong_decoration_invalidate(struct hopalong_view *view);
+extern int hopalong_decoration_get_title_width(struct hopalong_view *view);
+
 #endif
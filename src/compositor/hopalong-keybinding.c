@@ -82,6 +82,8 @@ switch_activity(struct hopalong_server *server, uint32_t modifiers, xkb_keysym_t
 	/* Move the previous view to the end of the list */
 	wl_list_remove(&current_view->mapped_link);
 	wl_list_insert(server->mapped_layers[HOPALONG_LAYER_MIDDLE].prev, &current_view->mapped_link);
+
+	hopalong_view_damage_whole(current_view);
 }
 
 static void
@@ -90,7 +92,10 @@ toggle_title_bar(struct hopalong_server *server, uint32_t modifiers, xkb_keysym_
 	struct hopalong_view *current_view = wl_container_of(server->mapped_layers[HOPALONG_LAYER_MIDDLE].next, current_view, mapped_link);
 
 	if (current_view != NULL)
+	{
 		current_view->hide_title_bar ^= true;
+		hopalong_view_damage_whole(current_view);
+	}
 }
 
 static struct hopalong_keybinding *
@@ -220,6 +220,8 @@ arrange_layer(struct wlr_output *output, struct wl_list *list, struct wlr_box *u
 		view->x = box.x;
 		view->y = box.y;
 
+		hopalong_view_damage_whole(view);
+
 		wlr_layer_surface_v1_configure(layer, box.width, box.height);
 	}
 }
@@ -300,12 +302,29 @@ hopalong_layer_shell_surface_at(struct hopalong_view *view, double x, double y,
 	return surface;
 }
 
+static uint32_t
+hopalong_layer_shell_set_size(struct hopalong_view *view, int width, int height)
+{
+	return 0;
+}
+
 static bool
 hopalong_layer_shell_can_move_or_resize(struct hopalong_view *view)
 {
 	return false;
 }
 
+/*
+ * Layer surfaces do ack configures with serials, but their size comes from
+ * the layout of their output, never from an interactive resize, so there
+ * is no configure for a resize to wait on.
+ */
+static bool
+hopalong_layer_shell_has_configure_serials(struct hopalong_view *view)
+{
+	return false;
+}
+
 static const struct hopalong_view_ops hopalong_layer_shell_view_ops = {
 	.minimize = hopalong_layer_shell_nop,
 	.maximize = hopalong_layer_shell_nop,
@@ -314,10 +333,11 @@ static const struct hopalong_view_ops hopalong_layer_shell_view_ops = {
 	.get_surface = hopalong_layer_shell_get_surface,
 	.set_activated = (void *) hopalong_layer_shell_nop,
 	.get_geometry = hopalong_layer_shell_get_geometry,
-	.set_size = (void *) hopalong_layer_shell_nop,
+	.set_size = hopalong_layer_shell_set_size,
 	.surface_at = hopalong_layer_shell_surface_at,
 	.can_move = hopalong_layer_shell_can_move_or_resize,
 	.can_resize = hopalong_layer_shell_can_move_or_resize,
+	.has_configure_serials = hopalong_layer_shell_has_configure_serials,
 };
 
 static void
@@ -11,18 +11,25 @@
  * from the use of this software.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include "hopalong-server.h"
 #include "hopalong-output.h"
+#include "hopalong-batch.h"
+#include "hopalong-decoration.h"
+#include "hopalong-title-cache.h"
+#include "hopalong-shell.h"
+#include "hopalong-cursor.h"
 
 #include <wlr/render/gles2.h>
-#include <GLES2/gl2.h>
+#include <wlr/util/region.h>
 
 struct render_data {
 	struct wlr_output *output;
 	struct hopalong_view *view;
 	struct wlr_renderer *renderer;
-	struct timespec *when;
+	pixman_region32_t *damage;
+	struct hopalong_batch *batch;
 	struct hopalong_generated_textures *textures;
 };
 
@@ -42,6 +49,47 @@ scale_box(struct wlr_box *box, float scale)
 	box->height *= scale;
 }
 
+/*
+ * Damage regions are kept in output-local coordinates, while the scissor box
+ * is applied to the untransformed buffer.
+ */
+void
+hopalong_output_scissor(struct wlr_output *output, pixman_box32_t *rect)
+{
+	struct wlr_box box = {
+		.x = rect->x1,
+		.y = rect->y1,
+		.width = rect->x2 - rect->x1,
+		.height = rect->y2 - rect->y1,
+	};
+
+	int ow, oh;
+	wlr_output_transformed_resolution(output, &ow, &oh);
+
+	enum wl_output_transform transform = wlr_output_transform_invert(output->transform);
+	wlr_box_transform(&box, &box, transform, ow, oh);
+
+	wlr_renderer_scissor(output->renderer, &box);
+}
+
+/*
+ * Computes the part of the frame damage covered by box.  Returns false if
+ * there is nothing to repaint there, in which case the region is already
+ * finalized.
+ */
+static bool
+damage_for_box(pixman_region32_t *out, pixman_region32_t *damage, const struct wlr_box *box)
+{
+	pixman_region32_init(out);
+	pixman_region32_intersect_rect(out, damage, box->x, box->y, box->width, box->height);
+
+	if (pixman_region32_not_empty(out))
+		return true;
+
+	pixman_region32_fini(out);
+	return false;
+}
+
 static void
 render_surface(struct wlr_surface *surface, int sx, int sy, void *data)
 {
@@ -76,49 +124,33 @@ render_surface(struct wlr_surface *surface, int sx, int sy, void *data)
 	};
 	scale_box(&box, output->scale);
 
+	/* skip surfaces which are not damaged */
+	pixman_region32_t damage;
+	if (!damage_for_box(&damage, rdata->damage, &box))
+		return;
+
+	hopalong_batch_flush_if_overlaps(rdata->batch, &box);
+
 	/* convert box to matrix */
 	float matrix[9];
 	enum wl_output_transform transform = wlr_output_transform_invert(surface->current.transform);
 	wlr_matrix_project_box(matrix, &box, transform, 0, output->transform_matrix);
 
-	/* render the matrix + texture to the screen */
-	wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
-
-	/* tell the client rendering is done */
-	wlr_surface_send_frame_done(surface, rdata->when);
-}
-
-static void
-render_texture(struct wlr_output *output, struct wlr_box *box, struct wlr_texture *texture, float texture_scale)
-{
-	return_if_fail(texture != NULL);
-
-	struct wlr_renderer *renderer = output->renderer;
-	struct wlr_box scalebox = {
-		.x = box->x,
-		.y = box->y,
-		.width = box->width * texture_scale,
-		.height = box->height * texture_scale,
-	};
-	scale_box_coords(&scalebox, output->scale);
-
-	struct wlr_gles2_texture_attribs attribs;
-	wlr_gles2_texture_get_attribs(texture, &attribs);
-	glBindTexture(attribs.target, attribs.tex);
-	glTexParameteri(attribs.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	float matrix[9];
-	wlr_matrix_project_box(matrix, &scalebox,
-		WL_OUTPUT_TRANSFORM_NORMAL,
-		0.0, output->transform_matrix);
+	/* render the matrix + texture to the screen, one damaged rect at a time */
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&damage, &nrects);
+	for (int i = 0; i < nrects; i++)
+	{
+		hopalong_output_scissor(output, &rects[i]);
+		wlr_render_texture_with_matrix(rdata->renderer, texture, matrix, 1);
+	}
 
-	wlr_render_texture_with_matrix(renderer, texture, matrix, 1.0);
+	pixman_region32_fini(&damage);
 }
 
 static void
-render_rect(struct wlr_output *output, struct wlr_box *box, const float color[4])
+render_rect(struct wlr_output *output, struct hopalong_batch *batch, pixman_region32_t *output_damage, struct wlr_box *box, const float color[4])
 {
-	struct wlr_renderer *renderer = output->renderer;
 	struct wlr_box scalebox = {
 		.x = box->x,
 		.y = box->y,
@@ -127,197 +159,491 @@ render_rect(struct wlr_output *output, struct wlr_box *box, const float color[4]
 	};
 	scale_box(&scalebox, output->scale);
 
-	wlr_render_rect(renderer, &scalebox, color, output->transform_matrix);
+	hopalong_batch_add_rect(batch, output_damage, &scalebox, color);
 }
 
-#define BORDER_HITBOX_THICKNESS		(4)
-
 static void
 render_view_surface(struct hopalong_view *view, struct render_data *data)
 {
-	if (view->xdg_surface != NULL)
+	hopalong_view_for_each_surface(view, render_surface, data);
+}
+
+/*
+ * Computes the box enclosing the borders of a view, in output-local
+ * coordinates.  The title bar sits on top of it.
+ */
+static bool
+get_frame_box(struct hopalong_view *view, struct wlr_output *output, struct wlr_box *base_box)
+{
+	const struct hopalong_style *style = view->server->style;
+
+	/* translate to output-local coordinates */
+	double ox = 0, oy = 0;
+	wlr_output_layout_output_coords(view->server->output_layout, output, &ox, &oy);
+	ox += view->x;
+	oy += view->y + 1;
+
+	struct wlr_box box;
+	if (!hopalong_view_get_geometry(view, &box))
+		return false;
+
+	base_box->x = (ox - style->border_thickness);
+	base_box->y = (oy - style->border_thickness);
+	base_box->width = (box.width + (style->border_thickness * 2));
+	base_box->height = (box.height + (style->border_thickness * 2)) - 1;
+
+	return true;
+}
+
+/*
+ * Finds the image for a decoration quad at the scale of the output being
+ * rendered.  A title not rendered at this scale yet is queued, and shows up
+ * on the next frame.
+ */
+static const struct hopalong_atlas_entry *
+decoration_image(struct hopalong_view *view, struct render_data *rdata, enum hopalong_decoration_image image)
+{
+	const struct hopalong_generated_textures *textures = rdata->textures;
+	bool activated = view->decoration.activated;
+
+	switch (image)
 	{
-		wlr_xdg_surface_for_each_surface(view->xdg_surface, render_surface, data);
-		return;
-	}
-	else if (view->layer_surface != NULL)
+	case HOPALONG_DECORATION_IMAGE_TITLE:
 	{
-		wlr_layer_surface_v1_for_each_surface(view->layer_surface, render_surface, data);
-		return;
+		const struct hopalong_view_title *title = hopalong_view_get_title(view, rdata->output->scale);
+		if (title == NULL)
+		{
+			if (view->title_job == NULL && view->ntitles < HOPALONG_VIEW_MAX_SCALES)
+			{
+				hopalong_view_set_title_dirty(view);
+				wlr_output_schedule_frame(rdata->output);
+			}
+
+			return NULL;
+		}
+
+		return title->cached->mask;
 	}
-	else if (view->xwayland_surface != NULL)
-	{
-		struct wlr_surface *surface = hopalong_view_get_surface(view);
+	case HOPALONG_DECORATION_IMAGE_MINIMIZE:
+		return activated ? textures->minimize : textures->minimize_inactive;
+	case HOPALONG_DECORATION_IMAGE_MAXIMIZE:
+		return activated ? textures->maximize : textures->maximize_inactive;
+	case HOPALONG_DECORATION_IMAGE_CLOSE:
+		return activated ? textures->close : textures->close_inactive;
+	default:
+		return NULL;
+	}
+}
+
+static void
+render_decorations(struct hopalong_view *view, struct render_data *rdata)
+{
+	struct wlr_output *output = rdata->output;
+	struct hopalong_decoration *deco = &view->decoration;
 
-		render_surface(surface, 0, 0, data);
+	/* laid out by hopalong_view_update_layout() */
+	if (!deco->valid)
 		return;
-	}
 
-	wlr_log(WLR_ERROR, "render_view_surface: don't know how to render view %p", view);
+	/* translate to output-local coordinates */
+	double ox = 0, oy = 0;
+	wlr_output_layout_output_coords(view->server->output_layout, output, &ox, &oy);
+	ox += view->x;
+	oy += view->y;
+
+	for (size_t i = 0; i < deco->nquads; i++)
+	{
+		struct hopalong_decoration_quad *quad = &deco->quads[i];
+		struct wlr_box box = {
+			.x = quad->box.x + ox,
+			.y = quad->box.y + oy,
+			.width = quad->box.width,
+			.height = quad->box.height,
+		};
+
+		if (quad->image == HOPALONG_DECORATION_IMAGE_NONE)
+		{
+			render_rect(output, rdata->batch, rdata->damage, &box, quad->color);
+			continue;
+		}
+
+		const struct hopalong_atlas_entry *image = decoration_image(view, rdata, quad->image);
+		if (image == NULL)
+			continue;
+
+		scale_box(&box, output->scale);
+
+		/* titles are laid out for the largest scale, so keep their own size */
+		if (quad->image == HOPALONG_DECORATION_IMAGE_TITLE)
+		{
+			box.width = image->box.width;
+			box.height = image->box.height;
+		}
+
+		hopalong_batch_add_image(rdata->batch, rdata->damage, &box, image, quad->color);
+	}
 }
 
 static void
 render_container(struct hopalong_view *view, struct render_data *data)
 {
-	const struct hopalong_style *style = view->server->style;
-	return_if_fail(style != NULL);
-
 	struct render_data *rdata = data;
 	return_if_fail(rdata != NULL);
 
-	struct wlr_output *output = rdata->output;
-	return_if_fail(output != NULL);
-
 	if (view->using_csd)
 	{
 		render_view_surface(view, data);
 		return;
 	}
 
-	/* translate to output-local coordinates */
-	double ox = 0, oy = 0;
-	wlr_output_layout_output_coords(view->server->output_layout, output, &ox, &oy);
-	ox += view->x;
-	oy += view->y + 1;
+	render_decorations(view, rdata);
 
-	/* scratch geometry */
-	struct wlr_box box;
-	if (!hopalong_view_get_geometry(view, &box))
+	/* render the surface itself */
+	render_view_surface(view, data);
+}
+
+struct opaque_data {
+	struct hopalong_view *view;
+	struct wlr_output *output;
+	pixman_region32_t *opaque;
+};
+
+static void
+add_surface_opaque_region(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	struct opaque_data *odata = data;
+	struct wlr_output *output = odata->output;
+
+	struct wlr_texture *texture = wlr_surface_get_texture(surface);
+	if (texture == NULL)
 		return;
 
-	box.x = (ox - style->border_thickness);
-	box.y = (oy - style->border_thickness);
-	box.width = (box.width + (style->border_thickness * 2));
-	box.height = (box.height + (style->border_thickness * 2)) - 1;
-
-	/* copy scratch to base_box */
-	struct wlr_box base_box = {
-		.x = box.x,
-		.y = box.y,
-		.width = box.width,
-		.height = box.height,
+	pixman_region32_t region;
+	pixman_region32_init(&region);
+
+	/* buffers without an alpha channel are opaque regardless of what the client says */
+	struct wlr_gles2_texture_attribs attribs = {};
+	if (wlr_texture_is_gles2(texture))
+		wlr_gles2_texture_get_attribs(texture, &attribs);
+
+	if (wlr_texture_is_gles2(texture) && !attribs.has_alpha)
+		pixman_region32_union_rect(&region, &region, 0, 0, surface->current.width, surface->current.height);
+	else
+		pixman_region32_intersect_rect(&region, &surface->opaque_region,
+			0, 0, surface->current.width, surface->current.height);
+
+	double ox = odata->view->x + sx, oy = odata->view->y + sy;
+	wlr_output_layout_output_coords(odata->view->server->output_layout, output, &ox, &oy);
+	pixman_region32_translate(&region, ox, oy);
+
+	wlr_region_scale(&region, &region, output->scale);
+
+	/* scaling rounds outwards, which is only safe for integer scales */
+	if (output->scale != (int) output->scale)
+		wlr_region_expand(&region, &region, -1);
+
+	pixman_region32_union(odata->opaque, odata->opaque, &region);
+	pixman_region32_fini(&region);
+}
+
+/*
+ * Adds everything a view is guaranteed to paint over completely to an
+ * opaque region in output-local coordinates.
+ */
+static void
+add_view_opaque_region(struct hopalong_view *view, struct wlr_output *output, pixman_region32_t *opaque)
+{
+	struct opaque_data odata = {
+		.view = view,
+		.output = output,
+		.opaque = opaque,
 	};
 
+	hopalong_view_for_each_surface(view, add_surface_opaque_region, &odata);
+
+	if (view->using_csd)
+		return;
+
+	/* the title bar is drawn over the top border, so only the border color matters */
+	const struct hopalong_style *style = view->server->style;
+	if (style->border[3] < 1.0)
+		return;
+
+	struct wlr_box base_box;
+	if (!get_frame_box(view, output, &base_box))
+		return;
+
 	int title_bar_offset = (view->hide_title_bar ? 0 : style->title_bar_height) + style->border_thickness;
 
-	/* render borders, starting with top */
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TOP] = (struct wlr_box){
+	struct wlr_box frame = {
 		.x = base_box.x,
 		.y = base_box.y - title_bar_offset,
 		.width = base_box.width,
-		.height = title_bar_offset,
+		.height = base_box.height + title_bar_offset,
 	};
-	render_rect(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TOP], style->border);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TOP].y -= BORDER_HITBOX_THICKNESS;
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TOP].height += BORDER_HITBOX_THICKNESS;
-
-	/* bottom border */
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_BOTTOM] = (struct wlr_box){
-		.x = base_box.x,
-		.y = base_box.y + base_box.height - style->border_thickness,
-		.width = base_box.width,
-		.height = style->border_thickness,
-	};
-	render_rect(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_BOTTOM], style->border);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_BOTTOM].height += BORDER_HITBOX_THICKNESS;
-
-	/* left border */
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_LEFT] = (struct wlr_box){
-		.x = base_box.x,
+	struct wlr_box interior = {
+		.x = base_box.x + style->border_thickness,
 		.y = base_box.y,
-		.width = style->border_thickness,
-		.height = base_box.height,
+		.width = base_box.width - (style->border_thickness * 2),
+		.height = base_box.height - style->border_thickness,
 	};
-	render_rect(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_LEFT], style->border);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_LEFT].x -= BORDER_HITBOX_THICKNESS;
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_LEFT].width += BORDER_HITBOX_THICKNESS;
+	scale_box(&frame, output->scale);
+	scale_box(&interior, output->scale);
 
-	/* right border */
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_RIGHT] = (struct wlr_box){
-		.x = base_box.x + base_box.width - style->border_thickness,
-		.y = base_box.y,
-		.width = style->border_thickness,
-		.height = base_box.height,
-	};
-	render_rect(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_RIGHT], style->border);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_RIGHT].width += BORDER_HITBOX_THICKNESS;
+	pixman_region32_t region;
+	pixman_region32_init_rect(&region, frame.x, frame.y, frame.width, frame.height);
 
-	/* title bar */
-	if (view->hide_title_bar)
-		goto skip_title_bar;
+	if (interior.width > 0 && interior.height > 0)
+	{
+		pixman_region32_t hole;
+		pixman_region32_init_rect(&hole, interior.x, interior.y, interior.width, interior.height);
+		pixman_region32_subtract(&region, &region, &hole);
+		pixman_region32_fini(&hole);
+	}
 
-	bool activated = view->activated;
+	pixman_region32_union(opaque, opaque, &region);
+	pixman_region32_fini(&region);
+}
 
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR] = (struct wlr_box){
-		.x = base_box.x + style->border_thickness,
-		.y = base_box.y - style->title_bar_height,
-		.width = base_box.width - (style->border_thickness * 2),
-		.height = style->title_bar_height + 1,
-	};
-	render_rect(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR],
-		activated ? style->title_bar_bg : style->title_bar_bg_inactive);
+struct render_item {
+	struct hopalong_view *view;
+	pixman_region32_t damage;
+};
+
+/*
+ * Builds the list of views visible on this output, bottom to top, and
+ * works out which part of the frame damage each of them actually has to
+ * repaint: a view does not need to paint anything that an opaque view above
+ * it covers.  Whatever is left uncovered by all views needs to be cleared.
+ */
+static void
+hopalong_output_cull_views(struct hopalong_output *output, pixman_region32_t *damage, pixman_region32_t *clear)
+{
+	struct wlr_output *wlr_output = output->wlr_output;
 
-	/* title bar text */
-	if (view->title != NULL)
+	output->render_list.size = 0;
+
+	for (size_t i = 0; i < HOPALONG_LAYER_COUNT; i++)
 	{
-		box = (struct wlr_box){
-			.x = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].x + style->title_bar_padding,
-			.y = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].y + style->title_bar_padding,
-			.width = view->title_box.width,
-			.height = view->title_box.height,
-		};
+		struct hopalong_view *view;
+
+		wl_list_for_each_reverse(view, &output->server->mapped_layers[i], mapped_link)
+		{
+			/* views which are not on this output at all are skipped outright */
+			if (!wlr_output_layout_intersects(output->server->output_layout, wlr_output, &view->bounds))
+				continue;
+
+			struct render_item *item = wl_array_add(&output->render_list, sizeof(*item));
+			return_if_fail(item != NULL);
 
-		render_texture(output, &box, activated ? view->title : view->title_inactive, 1.0f);
+			item->view = view;
+			pixman_region32_init(&item->damage);
+		}
 	}
 
-	/* close button */
-	return_if_fail(rdata->textures->close != NULL);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_CLOSE] = (struct wlr_box){
-		.x = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].x + (base_box.width - style->border_thickness - (style->title_bar_padding * 3)),
-		.y = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_TITLEBAR].y + style->title_bar_padding,
-		.width = 16,
-		.height = 16,
-	};
-	render_texture(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_CLOSE],
-		activated ? rdata->textures->close : rdata->textures->close_inactive, output->scale);
-
-	return_if_fail(rdata->textures->maximize != NULL);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE] = (struct wlr_box){
-		.x = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_CLOSE].x - (16 + style->title_bar_padding),
-		.y = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_CLOSE].y,
-		.width = 16,
-		.height = 16,
-	};
-	render_texture(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE],
-		activated ? rdata->textures->maximize : rdata->textures->maximize_inactive, output->scale);
-
-	return_if_fail(rdata->textures->minimize != NULL);
-	view->frame_areas[HOPALONG_VIEW_FRAME_AREA_MINIMIZE] = (struct wlr_box){
-		.x = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE].x - (16 + style->title_bar_padding),
-		.y = view->frame_areas[HOPALONG_VIEW_FRAME_AREA_MAXIMIZE].y,
-		.width = 16,
-		.height = 16,
-	};
-	render_texture(output, &view->frame_areas[HOPALONG_VIEW_FRAME_AREA_MINIMIZE],
-		activated ? rdata->textures->minimize : rdata->textures->minimize_inactive, output->scale);
+	pixman_region32_t opaque;
+	pixman_region32_init(&opaque);
 
-skip_title_bar:
-	/* render the surface itself */
-	render_view_surface(view, data);
+	struct render_item *items = output->render_list.data;
+	size_t nitems = output->render_list.size / sizeof(*items);
+
+	for (size_t i = nitems; i-- > 0; )
+	{
+		struct hopalong_view *view = items[i].view;
+
+		double ox = view->bounds.x, oy = view->bounds.y;
+		wlr_output_layout_output_coords(output->server->output_layout, wlr_output, &ox, &oy);
+
+		struct wlr_box box = {
+			.x = ox,
+			.y = oy,
+			.width = view->bounds.width,
+			.height = view->bounds.height,
+		};
+		scale_box(&box, wlr_output->scale);
+
+		pixman_region32_intersect_rect(&items[i].damage, damage, box.x, box.y, box.width, box.height);
+		pixman_region32_subtract(&items[i].damage, &items[i].damage, &opaque);
+
+		/* a fully covered view cannot cover anything more below it */
+		if (pixman_region32_not_empty(&items[i].damage))
+			add_view_opaque_region(view, wlr_output, &opaque);
+	}
+
+	pixman_region32_subtract(clear, damage, &opaque);
+	pixman_region32_fini(&opaque);
 }
 
 static void
 regenerate_textures(struct hopalong_output *output)
 {
-	struct hopalong_view *view;
+	hopalong_view_render_dirty_titles(output->server);
+}
 
-	wl_list_for_each_reverse(view, &output->server->views, link)
+static void
+send_frame_done(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	struct timespec *when = data;
+	wlr_surface_send_frame_done(surface, when);
+}
+
+static void
+hopalong_output_send_frame_done(struct hopalong_output *output, struct timespec *when)
+{
+	for (size_t i = 0; i < HOPALONG_LAYER_COUNT; i++)
 	{
-		if (!view->mapped)
-			continue;
+		struct hopalong_view *view;
+
+		wl_list_for_each_reverse(view, &output->server->mapped_layers[i], mapped_link)
+		{
+			if (view->primary_output == output)
+				hopalong_view_for_each_surface(view, send_frame_done, when);
+		}
+	}
+}
+
+/*
+ * Whether a cursor has to be drawn into the output's buffer, as opposed to
+ * being shown on a hardware cursor plane.
+ */
+static bool
+hopalong_output_has_software_cursor(struct wlr_output *wlr_output)
+{
+	struct wlr_output_cursor *cursor;
+
+	wl_list_for_each(cursor, &wlr_output->cursors, link)
+	{
+		if (cursor->enabled && cursor->visible && cursor != wlr_output->hardware_cursor)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+count_surface(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	size_t *count = data;
+	(*count)++;
+}
+
+/*
+ * Finds the topmost view on the output, which is the only candidate for
+ * direct scanout.
+ */
+static struct hopalong_view *
+hopalong_output_top_view(struct hopalong_output *output)
+{
+	for (size_t i = HOPALONG_LAYER_COUNT; i-- > 0; )
+	{
+		struct hopalong_view *view;
+
+		wl_list_for_each(view, &output->server->mapped_layers[i], mapped_link)
+		{
+			if (wlr_output_layout_intersects(output->server->output_layout, output->wlr_output, &view->bounds))
+				return view;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Tries to put the buffer of a client covering the whole output on screen
+ * as is, without compositing.  This is possible when the topmost view is a
+ * single opaque surface, matching the output's scale and transform, which
+ * covers the output exactly.
+ */
+static bool
+hopalong_output_scan_out(struct hopalong_output *output)
+{
+	struct wlr_output *wlr_output = output->wlr_output;
+
+	if (hopalong_output_has_software_cursor(wlr_output))
+		return false;
+
+	struct hopalong_view *view = hopalong_output_top_view(output);
+	if (view == NULL)
+		return false;
+
+	struct wlr_surface *surface = hopalong_view_get_surface(view);
+	if (surface == NULL || surface->buffer == NULL)
+		return false;
+
+	size_t nsurfaces = 0;
+	hopalong_view_for_each_surface(view, count_surface, &nsurfaces);
+	if (nsurfaces != 1)
+		return false;
 
-		hopalong_view_generate_textures(output, view);
+	if (surface->current.scale != wlr_output->scale || surface->current.transform != wlr_output->transform)
+		return false;
+
+	/* the surface has to cover the output exactly.  decorations are drawn
+	 * below the surface, so none of them can show on the output then.
+	 */
+	struct wlr_box *output_box = wlr_output_layout_get_box(output->server->output_layout, wlr_output);
+	return_val_if_fail(output_box != NULL, false);
+
+	if (view->x != output_box->x || view->y != output_box->y ||
+	    surface->current.width != output_box->width || surface->current.height != output_box->height)
+		return false;
+
+	/* nothing may show through the buffer */
+	struct wlr_texture *texture = wlr_surface_get_texture(surface);
+	struct wlr_gles2_texture_attribs attribs = {};
+	if (texture != NULL && wlr_texture_is_gles2(texture))
+		wlr_gles2_texture_get_attribs(texture, &attribs);
+
+	if (texture == NULL || attribs.has_alpha)
+	{
+		pixman_box32_t surface_box = {
+			.x1 = 0,
+			.y1 = 0,
+			.x2 = surface->current.width,
+			.y2 = surface->current.height,
+		};
+
+		if (pixman_region32_contains_rectangle(&surface->opaque_region, &surface_box) != PIXMAN_REGION_IN)
+			return false;
+	}
+
+	wlr_output_attach_buffer(wlr_output, &surface->buffer->base);
+	if (!wlr_output_test(wlr_output))
+	{
+		wlr_output_rollback(wlr_output);
+		return false;
 	}
+
+	return wlr_output_commit(wlr_output);
+}
+
+/*
+ * Whether anything on the output changed since it was last repainted.
+ */
+static bool
+hopalong_output_is_dirty(struct hopalong_output *output)
+{
+	return output->wlr_output->needs_frame || pixman_region32_not_empty(&output->damage->current);
+}
+
+static void
+hopalong_output_count_frame(struct hopalong_output *output, bool rendered)
+{
+	if (rendered)
+	{
+		output->frames_rendered++;
+		output->rendering = true;
+		return;
+	}
+
+	output->frames_skipped++;
+
+	/* report once per burst of activity, so that an idle output stays quiet */
+	if (output->rendering)
+		wlr_log(WLR_DEBUG, "Output %s went idle: %lu frames rendered, %lu frames skipped",
+			output->wlr_output->name, output->frames_rendered, output->frames_skipped);
+
+	output->rendering = false;
 }
 
 static void
@@ -326,53 +652,217 @@ hopalong_output_frame_notify(struct wl_listener *listener, void *data)
 	struct hopalong_output *output = wl_container_of(listener, output, frame);
 	return_if_fail(output != NULL);
 
+	struct wlr_output *wlr_output = output->wlr_output;
+	return_if_fail(wlr_output != NULL);
+
 	struct wlr_renderer *renderer = output->server->renderer;
 	return_if_fail(renderer != NULL);
 
 	const struct hopalong_style *style = output->server->style;
 	return_if_fail(style != NULL);
 
-	/* regenerate textures */
+	/* pass on pointer motion which was held back for this frame */
+	hopalong_cursor_flush_motion(output->server);
+
+	/* regenerate textures, and draw the buttons if this scale is new */
 	regenerate_textures(output);
 
+	struct hopalong_generated_textures *textures =
+		hopalong_generated_textures_for_scale(output->server, wlr_output->scale);
+	return_if_fail(textures != NULL);
+
 	/* get our render TS */
 	struct timespec now;
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	if (!wlr_output_attach_render(output->wlr_output, NULL))
-		return;
+	bool needs_frame = hopalong_output_is_dirty(output);
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+
+	/* nothing changed on this output, so don't even acquire a buffer */
+	if (!needs_frame)
+		goto frame_done;
+
+	/* a client covering the whole output may not need compositing at all */
+	bool scanned_out = hopalong_output_scan_out(output);
+	if (scanned_out != output->scanned_out)
+	{
+		wlr_log(WLR_DEBUG, "%s direct scanout on output %s",
+			scanned_out ? "Starting" : "Stopping", wlr_output->name);
+
+		/* the last composited frame is stale by now */
+		if (!scanned_out)
+			hopalong_output_damage_whole(output);
+
+		output->scanned_out = scanned_out;
+	}
+
+	if (scanned_out)
+		goto frame_done;
+
+	if (!wlr_output_damage_attach_render(output->damage, &needs_frame, &damage))
+	{
+		needs_frame = false;
+		goto frame_done;
+	}
+
+	if (!needs_frame)
+	{
+		wlr_output_rollback(wlr_output);
+		goto frame_done;
+	}
 
 	/* start rendering */
-	wlr_renderer_begin(renderer, output->wlr_output->width, output->wlr_output->height);
+	wlr_renderer_begin(renderer, wlr_output->width, wlr_output->height);
 
-	/* clear to something slightly off-gray in order to show the renderer is alive */
-	wlr_renderer_clear(renderer, style->base_bg);
+	hopalong_batch_begin(output->server->batch, wlr_output);
 
-	/* render the views */
-	for (size_t i = 0; i < HOPALONG_LAYER_COUNT; i++)
+	/* work out what is visible, and what is not covered by anything */
+	pixman_region32_t clear;
+	pixman_region32_init(&clear);
+	hopalong_output_cull_views(output, &damage, &clear);
+
+	/* clear to something slightly off-gray in order to show the renderer is alive */
+	int nrects;
+	pixman_box32_t *rects = pixman_region32_rectangles(&clear, &nrects);
+	for (int i = 0; i < nrects; i++)
 	{
-		struct hopalong_view *view;
+		hopalong_output_scissor(wlr_output, &rects[i]);
+		wlr_renderer_clear(renderer, style->base_bg);
+	}
 
-		wl_list_for_each_reverse(view, &output->server->mapped_layers[i], mapped_link)
+	pixman_region32_fini(&clear);
+
+	/* render the views which are not fully occluded, bottom to top */
+	struct render_item *item;
+	wl_array_for_each(item, &output->render_list)
+	{
+		if (!pixman_region32_not_empty(&item->damage))
 		{
-			struct render_data rdata = {
-				.output = output->wlr_output,
-				.view = view,
-				.renderer = renderer,
-				.when = &now,
-				.textures = output->generated_textures,
-			};
-
-			render_container(view, &rdata);
+			pixman_region32_fini(&item->damage);
+			continue;
 		}
+
+		struct render_data rdata = {
+			.output = wlr_output,
+			.view = item->view,
+			.renderer = renderer,
+			.damage = &item->damage,
+			.batch = output->server->batch,
+			.textures = textures,
+		};
+
+		render_container(item->view, &rdata);
+		pixman_region32_fini(&item->damage);
+	}
+
+	hopalong_batch_flush(output->server->batch);
+
+	/* render our cursor if the output cannot show it on a cursor plane */
+	bool software_cursor = hopalong_output_has_software_cursor(wlr_output);
+	if (software_cursor != output->software_cursor)
+	{
+		wlr_log(WLR_DEBUG, "Output %s: using %s cursor", wlr_output->name,
+			software_cursor ? "software" : "hardware");
+		output->software_cursor = software_cursor;
 	}
 
-	/* renderer our cursor if we need to */
-	wlr_output_render_software_cursors(output->wlr_output, NULL);
+	if (software_cursor)
+		wlr_output_render_software_cursors(wlr_output, &damage);
 
 	/* finish rendering */
+	wlr_renderer_scissor(renderer, NULL);
 	wlr_renderer_end(renderer);
-	wlr_output_commit(output->wlr_output);
+
+	/* tell the backend which parts of the buffer actually changed */
+	int width, height;
+	wlr_output_transformed_resolution(wlr_output, &width, &height);
+
+	pixman_region32_t frame_damage;
+	pixman_region32_init(&frame_damage);
+
+	enum wl_output_transform transform = wlr_output_transform_invert(wlr_output->transform);
+	wlr_region_transform(&frame_damage, &output->damage->current, transform, width, height);
+
+	wlr_output_set_damage(wlr_output, &frame_damage);
+	pixman_region32_fini(&frame_damage);
+
+	wlr_output_commit(wlr_output);
+
+frame_done:
+	pixman_region32_fini(&damage);
+	hopalong_output_count_frame(output, needs_frame);
+
+	/* clients may be waiting on a frame callback even if we did not repaint */
+	hopalong_output_send_frame_done(output, &now);
+}
+
+/*
+ * Adds a box in layout coordinates to the damage of an output.
+ */
+void
+hopalong_output_damage_box(struct hopalong_output *output, const struct wlr_box *box)
+{
+	return_if_fail(output != NULL);
+	return_if_fail(box != NULL);
+
+	if (!box->width || !box->height)
+		return;
+
+	double ox = box->x, oy = box->y;
+	wlr_output_layout_output_coords(output->server->output_layout, output->wlr_output, &ox, &oy);
+
+	struct wlr_box scalebox = {
+		.x = ox,
+		.y = oy,
+		.width = box->width,
+		.height = box->height,
+	};
+	scale_box(&scalebox, output->wlr_output->scale);
+
+	wlr_output_damage_add_box(output->damage, &scalebox);
+}
+
+/*
+ * Adds the damage a client committed to a surface at (lx, ly) in layout
+ * coordinates to the damage of an output.
+ */
+void
+hopalong_output_damage_surface(struct hopalong_output *output, struct wlr_surface *surface, double lx, double ly)
+{
+	return_if_fail(output != NULL);
+	return_if_fail(surface != NULL);
+
+	struct wlr_output *wlr_output = output->wlr_output;
+
+	double ox = lx, oy = ly;
+	wlr_output_layout_output_coords(output->server->output_layout, wlr_output, &ox, &oy);
+
+	pixman_region32_t damage;
+	pixman_region32_init(&damage);
+	wlr_surface_get_effective_damage(surface, &damage);
+
+	wlr_region_scale(&damage, &damage, wlr_output->scale);
+
+	/* account for filtering bleed when the client renders at a lower scale */
+	if (ceil(wlr_output->scale) > surface->current.scale)
+		wlr_region_expand(&damage, &damage, ceil(wlr_output->scale) - surface->current.scale);
+
+	pixman_region32_translate(&damage, ox * wlr_output->scale, oy * wlr_output->scale);
+	wlr_output_damage_add(output->damage, &damage);
+
+	pixman_region32_fini(&damage);
+}
+
+/*
+ * Marks an entire output as needing to be repainted.
+ */
+void
+hopalong_output_damage_whole(struct hopalong_output *output)
+{
+	return_if_fail(output != NULL);
+
+	wlr_output_damage_add_whole(output->damage);
 }
 
 #define HIDPI_DPI_LIMIT (2 * 96)
@@ -447,18 +937,28 @@ hopalong_output_new_from_wlr_output(struct hopalong_server *server, struct wlr_o
 
 	output->wlr_output = wlr_output;
 	output->server = server;
+	wl_array_init(&output->render_list);
 
-	output->frame.notify = hopalong_output_frame_notify;
-	wl_signal_add(&wlr_output->events.frame, &output->frame);
+	output->damage = wlr_output_damage_create(wlr_output);
+	if (output->damage == NULL)
+	{
+		free(output);
+		return NULL;
+	}
 
-	wlr_xcursor_manager_load(server->cursor_mgr, wlr_output->scale);
+	output->frame.notify = hopalong_output_frame_notify;
+	wl_signal_add(&output->damage->events.frame, &output->frame);
 
 	output_configure(output);
 
-	output->generated_textures = hopalong_generate_builtin_textures_for_output(output, server->style);
+	/* cursor themes are only loaded for the scales outputs actually use */
+	hopalong_cursor_load_scale(server, wlr_output->scale);
 
 	wl_list_insert(&server->outputs, &output->link);
 
+	/* nothing has been drawn on the new output yet */
+	hopalong_output_damage_whole(output);
+
 	return output;
 }
 
@@ -472,6 +972,25 @@ hopalong_output_destroy(struct hopalong_output *output)
 
 	/* XXX: should we destroy the underlying wlr_output? */
 
+	wlr_log(WLR_DEBUG, "Output %s: %lu frames rendered, %lu frames skipped",
+		output->wlr_output->name, output->frames_rendered, output->frames_skipped);
+
+	wl_list_remove(&output->frame.link);
 	wl_list_remove(&output->link);
+
+	/* the layout is about to shrink */
+	hopalong_shell_invalidate_hit_grid(output->server);
+	wl_array_release(&output->render_list);
+
+	struct hopalong_view *view;
+	wl_list_for_each(view, &output->server->views, link)
+	{
+		if (view->primary_output == output)
+			hopalong_view_update_primary_output(view);
+	}
+
+	/* the buttons may have been drawn at this output's scale only */
+	hopalong_generated_textures_prune(output->server);
+
 	free(output);
 }
@@ -24,6 +24,7 @@
 #include <wlr/types/wlr_keyboard.h>
 #include <wlr/types/wlr_matrix.h>
 #include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_damage.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
 #include <wlr/types/wlr_seat.h>
@@ -32,19 +33,35 @@
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
 
-struct hopalong_generated_textures;
 struct hopalong_server;
 
 struct hopalong_output {
 	struct wl_list link;
 	struct hopalong_server *server;
 	struct wlr_output *wlr_output;
+	struct wlr_output_damage *damage;
 	struct wl_listener frame;
 
-	struct hopalong_generated_textures *generated_textures;
+	/* frame statistics, to verify that idle outputs stay idle */
+	unsigned long frames_rendered;
+	unsigned long frames_skipped;
+	bool rendering;
+
+	/* whether a client buffer is currently shown without compositing */
+	bool scanned_out;
+
+	/* whether the cursor is drawn by us rather than on a cursor plane */
+	bool software_cursor;
+
+	/* scratch list of views being rendered in the current frame */
+	struct wl_array render_list;
 };
 
 extern struct hopalong_output *hopalong_output_new_from_wlr_output(struct hopalong_server *server, struct wlr_output *output);
 extern void hopalong_output_destroy(struct hopalong_output *output);
+extern void hopalong_output_damage_box(struct hopalong_output *output, const struct wlr_box *box);
+extern void hopalong_output_damage_surface(struct hopalong_output *output, struct wlr_surface *surface, double lx, double ly);
+extern void hopalong_output_damage_whole(struct hopalong_output *output);
+extern void hopalong_output_scissor(struct wlr_output *output, pixman_box32_t *rect);
 
 #endif
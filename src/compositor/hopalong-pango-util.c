@@ -62,10 +62,9 @@ hopalong_pango_util_escape_markup_text(const char *src, char *dest, size_t dest_
 	return length;
 }
 
-PangoLayout *
-hopalong_pango_util_get_pango_layout(cairo_t *cairo, const char *font, const char *text, double scale, bool markup)
+static void
+hopalong_pango_util_set_layout_text(PangoLayout *layout, const char *text, double scale, bool markup)
 {
-	PangoLayout *layout = pango_cairo_create_layout(cairo);
 	PangoAttrList *attrs;
 
 	if (markup)
@@ -87,6 +86,7 @@ hopalong_pango_util_get_pango_layout(cairo_t *cairo, const char *font, const cha
 		}
 	}
 
+	/* plain text is set as is, without being parsed or escaped */
 	if (!markup)
 	{
 		attrs = pango_attr_list_new();
@@ -94,16 +94,103 @@ hopalong_pango_util_get_pango_layout(cairo_t *cairo, const char *font, const cha
 	}
 
 	pango_attr_list_insert(attrs, pango_attr_scale_new(scale));
+	pango_layout_set_attributes(layout, attrs);
+	pango_attr_list_unref(attrs);
+}
+
+PangoLayout *
+hopalong_pango_util_get_pango_layout(cairo_t *cairo, const char *font, const char *text, double scale, bool markup)
+{
+	PangoLayout *layout = pango_cairo_create_layout(cairo);
+
+	hopalong_pango_util_set_layout_text(layout, text, scale, markup);
+
 	PangoFontDescription *desc = pango_font_description_from_string(font);
 	pango_layout_set_font_description(layout, desc);
 	pango_layout_set_single_paragraph_mode(layout, 1);
-	pango_layout_set_attributes(layout, attrs);
-	pango_attr_list_unref(attrs);
 	pango_font_description_free(desc);
 
 	return layout;
 }
 
+/*
+ * Parses a font once, and sets up a Pango context for laying out text in it
+ * with the font options used for decorations.  Layouts created from it can
+ * be kept and have their text replaced, instead of being created for every
+ * string that is drawn.
+ */
+struct hopalong_pango_font *
+hopalong_pango_util_font_new(const char *font)
+{
+	return_val_if_fail(font != NULL, NULL);
+
+	struct hopalong_pango_font *pfont = calloc(1, sizeof(*pfont));
+	return_val_if_fail(pfont != NULL, NULL);
+
+	pfont->desc = pango_font_description_from_string(font);
+	pfont->context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+
+	if (pfont->desc == NULL || pfont->context == NULL)
+	{
+		hopalong_pango_util_font_destroy(pfont);
+		return NULL;
+	}
+
+	cairo_font_options_t *fo = cairo_font_options_create();
+	cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
+	cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_GRAY);
+	pango_cairo_context_set_font_options(pfont->context, fo);
+	cairo_font_options_destroy(fo);
+
+	return pfont;
+}
+
+void
+hopalong_pango_util_font_destroy(struct hopalong_pango_font *pfont)
+{
+	return_if_fail(pfont != NULL);
+
+	if (pfont->context != NULL)
+		g_object_unref(pfont->context);
+
+	if (pfont->desc != NULL)
+		pango_font_description_free(pfont->desc);
+
+	free(pfont);
+}
+
+/*
+ * Creates a layout for single lines of text in the given font.
+ */
+PangoLayout *
+hopalong_pango_util_layout_new(struct hopalong_pango_font *pfont)
+{
+	return_val_if_fail(pfont != NULL, NULL);
+
+	PangoLayout *layout = pango_layout_new(pfont->context);
+	return_val_if_fail(layout != NULL, NULL);
+
+	pango_layout_set_font_description(layout, pfont->desc);
+	pango_layout_set_single_paragraph_mode(layout, 1);
+
+	return layout;
+}
+
+/*
+ * Replaces the text of a layout, and returns its size in pixels.  Untrusted
+ * strings such as window titles should be set with markup disabled; text
+ * meant as markup can be built with hopalong_pango_util_escape_markup_text().
+ */
+void
+hopalong_pango_util_layout_set_text(PangoLayout *layout, const char *text, double scale, bool markup, int *width, int *height)
+{
+	return_if_fail(layout != NULL);
+	return_if_fail(text != NULL);
+
+	hopalong_pango_util_set_layout_text(layout, text, scale, markup);
+	pango_layout_get_pixel_size(layout, width, height);
+}
+
 void
 hopalong_pango_util_get_text_size(cairo_t *cairo, const char *font, int *width, int *height,
 	int *baseline, double scale, bool markup, const char *fmt, ...)
@@ -21,10 +21,23 @@
 #include "hopalong-view.h"
 #include "hopalong-output.h"
 
+/*
+ * A parsed font and the Pango context used to lay out text in it.
+ */
+struct hopalong_pango_font {
+	PangoFontDescription *desc;
+	PangoContext *context;
+};
+
 extern size_t hopalong_pango_util_escape_markup_text(const char *src, char *dest, size_t dest_size);
 extern PangoLayout *hopalong_pango_util_get_pango_layout(cairo_t *cairo, const char *font, const char *text, double scale, bool markup);
 extern void hopalong_pango_util_get_text_size(cairo_t *cairo, const char *font, int *width, int *height,
 	int *baseline, double scale, bool markup, const char *fmt, ...);
 extern void hopalong_pango_util_printf(cairo_t *cairo, const char *font, double scale, bool markup, const char *fmt, ...);
 
+extern struct hopalong_pango_font *hopalong_pango_util_font_new(const char *font);
+extern void hopalong_pango_util_font_destroy(struct hopalong_pango_font *pfont);
+extern PangoLayout *hopalong_pango_util_layout_new(struct hopalong_pango_font *pfont);
+extern void hopalong_pango_util_layout_set_text(PangoLayout *layout, const char *text, double scale, bool markup, int *width, int *height);
+
 #endif
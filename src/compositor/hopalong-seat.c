@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include "hopalong-seat.h"
 #include "hopalong-server.h"
+#include "hopalong-cursor.h"
 #include "hopalong-keybinding.h"
 
 static void
@@ -136,7 +137,10 @@ hopalong_seat_request_cursor(struct wl_listener *listener, void *data)
 	struct wlr_seat_client *focused_client = server->seat->pointer_state.focused_client;
 
 	if (focused_client == event->seat_client)
-		wlr_cursor_set_surface(server->cursor, event->surface, event->hotspot_x, event->hotspot_y);
+	{
+		hopalong_cursor_set_surface(server, event->seat_client, event->surface,
+			event->hotspot_x, event->hotspot_y);
+	}
 }
 
 static void
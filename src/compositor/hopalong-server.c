@@ -19,12 +19,68 @@
 #include "hopalong-seat.h"
 #include "hopalong-xwayland.h"
 #include "hopalong-keybinding.h"
+#include "hopalong-pango-util.h"
+#include "hopalong-title-worker.h"
+#include "hopalong-title-cache.h"
+#include "hopalong-shell.h"
 
 #include <wlr/types/wlr_data_control_v1.h>
 #include <wlr/types/wlr_export_dmabuf_v1.h>
 #include <wlr/types/wlr_gamma_control_v1.h>
 #include <wlr/types/wlr_primary_selection_v1.h>
 
+struct hopalong_surface_tracker {
+	struct hopalong_server *server;
+	struct wlr_surface *surface;
+
+	struct wl_listener commit;
+	struct wl_listener destroy;
+};
+
+static void
+hopalong_surface_tracker_commit(struct wl_listener *listener, void *data)
+{
+	struct hopalong_surface_tracker *tracker = wl_container_of(listener, tracker, commit);
+
+	hopalong_view_damage_from_surface(tracker->server, tracker->surface);
+}
+
+static void
+hopalong_surface_tracker_destroy(struct wl_listener *listener, void *data)
+{
+	struct hopalong_surface_tracker *tracker = wl_container_of(listener, tracker, destroy);
+
+	wl_list_remove(&tracker->commit.link);
+	wl_list_remove(&tracker->destroy.link);
+	free(tracker);
+}
+
+/*
+ * Every client surface is tracked so that its commits can be turned into
+ * output damage, regardless of which shell (if any) it belongs to.
+ */
+static void
+hopalong_server_new_surface(struct wl_listener *listener, void *data)
+{
+	struct hopalong_server *server = wl_container_of(listener, server, new_surface);
+	return_if_fail(server != NULL);
+
+	struct wlr_surface *surface = data;
+	return_if_fail(surface != NULL);
+
+	struct hopalong_surface_tracker *tracker = calloc(1, sizeof(*tracker));
+	return_if_fail(tracker != NULL);
+
+	tracker->server = server;
+	tracker->surface = surface;
+
+	tracker->commit.notify = hopalong_surface_tracker_commit;
+	wl_signal_add(&surface->events.commit, &tracker->commit);
+
+	tracker->destroy.notify = hopalong_surface_tracker_destroy;
+	wl_signal_add(&surface->events.destroy, &tracker->destroy);
+}
+
 static void
 hopalong_server_new_output(struct wl_listener *listener, void *data)
 {
@@ -58,6 +114,23 @@ hopalong_server_new_output(struct wl_listener *listener, void *data)
 
 	/* TODO: configure position of output in the layout */
 	wlr_output_layout_add_auto(server->output_layout, wlr_output);
+
+	/* the layout grew, and hit testing has to cover it */
+	hopalong_shell_invalidate_hit_grid(server);
+
+	/* the new output has no cursor image yet */
+	hopalong_cursor_invalidate(server);
+
+	/* views may now be shown mostly on the new output, maybe at a new scale */
+	struct hopalong_view *view;
+	wl_list_for_each(view, &server->views, link)
+	{
+		hopalong_view_update_primary_output(view);
+
+		if (hopalong_view_get_title(view, wlr_output->scale) == NULL &&
+		    wlr_output_layout_intersects(server->output_layout, wlr_output, &view->bounds))
+			hopalong_view_set_title_dirty(view);
+	}
 }
 
 static bool
@@ -81,9 +154,26 @@ hopalong_server_initialize(struct hopalong_server *server, const struct hopalong
  	server->allocator = wlr_allocator_autocreate(server->backend, server->renderer);
  	return_val_if_fail(server->allocator != NULL, false);
 
+	/* decorations are drawn in batches from a shared atlas */
+	server->atlas = hopalong_atlas_new(server->renderer);
+	return_val_if_fail(server->atlas != NULL, false);
+
+	/* button textures are drawn for each output scale on first use */
+	wl_list_init(&server->generated_textures);
+
+	/* views with the same title share its image */
+	server->title_cache = hopalong_title_cache_new(server->atlas);
+	return_val_if_fail(server->title_cache != NULL, false);
+
+	server->batch = hopalong_batch_new(server->renderer, server->atlas);
+	return_val_if_fail(server->batch != NULL, false);
+
 	/* start hooking up wlroots stuff */
 	wlr_renderer_init_wl_display(server->renderer, server->display);
 	server->compositor = wlr_compositor_create(server->display, server->renderer);
+
+	server->new_surface.notify = hopalong_server_new_surface;
+	wl_signal_add(&server->compositor->events.new_surface, &server->new_surface);
 	wlr_data_device_manager_create(server->display);
 
 	/* set up output layout manager */
@@ -100,6 +190,12 @@ hopalong_server_initialize(struct hopalong_server *server, const struct hopalong
 
 	/* initialize view lists */
 	wl_list_init(&server->views);
+	wl_list_init(&server->dirty_titles);
+
+	/* comes back for titles held back by throttling */
+	server->title_timer = wl_event_loop_add_timer(wl_display_get_event_loop(server->display),
+		hopalong_view_title_timer_notify, server);
+	return_val_if_fail(server->title_timer != NULL, false);
 
 	/* initialize the layers */
 	for (size_t i = 0; i < HOPALONG_LAYER_COUNT; i++)
@@ -129,6 +225,7 @@ hopalong_server_initialize(struct hopalong_server *server, const struct hopalong
 	wlr_data_control_manager_v1_create(server->display);
 	wlr_gamma_control_manager_v1_create(server->display);
 	wlr_primary_selection_v1_device_manager_create(server->display);
+	server->relative_pointer_mgr = wlr_relative_pointer_manager_v1_create(server->display);
 
 	/* set up style */
 	if (options->style_name != NULL)
@@ -136,6 +233,14 @@ hopalong_server_initialize(struct hopalong_server *server, const struct hopalong
 	else
 		server->style = hopalong_style_get_default();
 
+	/* titles are all laid out with the same font */
+	server->title_font = hopalong_pango_util_font_new(server->style->title_bar_font);
+	return_val_if_fail(server->title_font != NULL, false);
+
+	/* and rendered off the main thread */
+	server->title_worker = hopalong_title_worker_new(server, server->style->title_bar_font);
+	return_val_if_fail(server->title_worker != NULL, false);
+
 	return true;
 }
 
@@ -189,9 +294,36 @@ hopalong_server_destroy(struct hopalong_server *server)
 	hopalong_xdg_shell_teardown(server);
 	hopalong_keybinding_teardown(server);
 
+	if (server->title_timer)
+	{
+		wlr_log(WLR_DEBUG, "Titles: %lu rendered, %lu updates dropped",
+			server->titles_rendered, server->title_updates_dropped);
+		wl_event_source_remove(server->title_timer);
+	}
+
+	hopalong_shell_destroy_hit_grid(server);
+
 	if (server->output_layout)
 		wlr_output_layout_destroy(server->output_layout);
 
+	if (server->batch)
+		hopalong_batch_destroy(server->batch);
+
+	if (server->title_worker)
+		hopalong_title_worker_destroy(server->title_worker);
+
+	if (server->title_font)
+		hopalong_pango_util_font_destroy(server->title_font);
+
+	if (server->atlas)
+	{
+		if (server->title_cache)
+			hopalong_title_cache_destroy(server->title_cache);
+
+		hopalong_generated_textures_destroy_all(server);
+		hopalong_atlas_destroy(server->atlas);
+	}
+
 	if (server->backend)
 		wlr_backend_destroy(server->backend);
 
@@ -27,6 +27,7 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/types/wlr_seat.h>
 #include <wlr/types/wlr_screencopy_v1.h>
 #include <wlr/types/wlr_server_decoration.h>
@@ -43,6 +44,19 @@
 #include "hopalong-xwayland.h"
 #include "hopalong-style.h"
 #include "hopalong-layer-shell.h"
+#include "hopalong-atlas.h"
+#include "hopalong-batch.h"
+
+struct hopalong_pango_font;
+struct hopalong_title_worker;
+struct hopalong_title_cache;
+struct hopalong_hit_grid;
+
+enum hopalong_cursor_owner {
+	HOPALONG_CURSOR_OWNER_NONE,
+	HOPALONG_CURSOR_OWNER_COMPOSITOR,
+	HOPALONG_CURSOR_OWNER_CLIENT
+};
 
 enum hopalong_cursor_mode {
 	HOPALONG_CURSOR_PASSTHROUGH,
@@ -54,22 +68,46 @@ struct hopalong_server {
 	struct wl_display *display;
 	struct wlr_backend *backend;
 	struct wlr_renderer *renderer;
+	struct hopalong_atlas *atlas;
+	struct hopalong_batch *batch;
+	struct wl_list generated_textures;
  	struct wlr_allocator *allocator;
 	struct wlr_compositor *compositor;
+	struct wl_listener new_surface;
 
 	struct wlr_xdg_shell *xdg_shell;
 	struct wl_listener new_xdg_surface;
 
 	struct wl_list views;
+	struct wl_list dirty_titles;
+	struct wl_event_source *title_timer;
+	unsigned long titles_rendered;
+	unsigned long title_updates_dropped;
 	struct wl_list mapped_layers[HOPALONG_LAYER_COUNT];
+	struct hopalong_hit_grid *hit_grid;
 
 	struct wlr_cursor *cursor;
 	struct wlr_xcursor_manager *cursor_mgr;
+
+	/* what the cursor currently shows, and who chose it */
+	enum hopalong_cursor_owner cursor_owner;
+	const char *cursor_image;
+	struct wlr_seat_client *cursor_client;
+	struct wlr_surface *cursor_surface;
+	int32_t cursor_hotspot_x, cursor_hotspot_y;
+	struct wl_listener cursor_surface_destroy;
+	struct wl_listener cursor_client_destroy;
+
 	struct wl_listener cursor_motion;
 	struct wl_listener cursor_motion_absolute;
 	struct wl_listener cursor_button;
 	struct wl_listener cursor_axis;
 	struct wl_listener cursor_frame;
+	struct wlr_relative_pointer_manager_v1 *relative_pointer_mgr;
+
+	/* pointer motion held back until the next output frame */
+	bool motion_pending;
+	uint32_t motion_time_msec;
 
 	struct wlr_seat *seat;
 	struct wl_listener new_input;
@@ -96,6 +134,9 @@ struct hopalong_server {
 	struct wl_listener new_xwayland_surface;
 
 	const struct hopalong_style *style;
+	struct hopalong_pango_font *title_font;
+	struct hopalong_title_worker *title_worker;
+	struct hopalong_title_cache *title_cache;
 
 	struct wlr_xdg_output_manager_v1 *xdg_output_manager;
 	struct wlr_layer_shell_v1 *wlr_layer_shell;
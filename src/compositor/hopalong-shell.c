@@ -11,6 +11,7 @@
  * from the use of this software.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include "hopalong-shell.h"
 #include "hopalong-server.h"
@@ -62,20 +63,357 @@ hopalong_shell_view_at(struct hopalong_view *view,
 	return view->frame_area != -1;
 }
 
+/*
+ * Hit-testing goes through a uniform grid over the output layout.  Each cell
+ * lists the views whose surfaces or decorations reach into it, topmost
+ * first, so only a few views have to be tested for any point.  The grid is
+ * built again on the next lookup after any view moved, resized, or was
+ * mapped, unmapped or restacked.
+ */
+#define HIT_GRID_CELL_SIZE	(128)
+
+struct hit_grid_entry {
+	struct hopalong_view *view;
+	struct wlr_box box;
+};
+
+struct hopalong_hit_grid {
+	bool dirty;
+
+	struct wlr_box extents;
+	int cols, rows;
+	struct wl_array *cells;
+
+	/*
+	 * The result of the last lookup, valid until anything changes.  It holds
+	 * at the same point, and for surfaces also anywhere in last_box as long
+	 * as no other view is in the way.
+	 */
+	bool last_valid;
+	double last_lx, last_ly;
+	struct wlr_box last_box;
+	struct hopalong_view *last_view;
+	struct wlr_surface *last_surface;
+	double last_origin_x, last_origin_y;
+	int last_frame_area;
+	int last_frame_area_edges;
+};
+
+static void
+hit_grid_add_view(struct hopalong_hit_grid *grid, struct hopalong_view *view)
+{
+	/* the frame areas reach a little beyond the decorations */
+	struct wlr_box box = view->bounds;
+	for (size_t i = 0; i < HOPALONG_VIEW_FRAME_AREA_COUNT; i++)
+		hopalong_view_box_union(&box, &view->frame_areas[i]);
+
+	if (!box.width && !box.height)
+		return;
+
+	/* frame areas are hit up to and including their far edges */
+	int col1 = floor((double) (box.x - grid->extents.x) / HIT_GRID_CELL_SIZE);
+	int row1 = floor((double) (box.y - grid->extents.y) / HIT_GRID_CELL_SIZE);
+	int col2 = (box.x + box.width - grid->extents.x) / HIT_GRID_CELL_SIZE;
+	int row2 = (box.y + box.height - grid->extents.y) / HIT_GRID_CELL_SIZE;
+
+	col1 = col1 < 0 ? 0 : col1;
+	row1 = row1 < 0 ? 0 : row1;
+	col2 = col2 >= grid->cols ? grid->cols - 1 : col2;
+	row2 = row2 >= grid->rows ? grid->rows - 1 : row2;
+
+	for (int row = row1; row <= row2; row++)
+	{
+		for (int col = col1; col <= col2; col++)
+		{
+			struct hit_grid_entry *entry = wl_array_add(&grid->cells[row * grid->cols + col], sizeof(*entry));
+			return_if_fail(entry != NULL);
+
+			entry->view = view;
+			entry->box = box;
+		}
+	}
+}
+
+static void
+hit_grid_release_cells(struct hopalong_hit_grid *grid)
+{
+	for (int i = 0; i < grid->cols * grid->rows; i++)
+		wl_array_release(&grid->cells[i]);
+
+	free(grid->cells);
+	grid->cells = NULL;
+	grid->cols = grid->rows = 0;
+}
+
+static void
+hit_grid_rebuild(struct hopalong_server *server, struct hopalong_hit_grid *grid)
+{
+	grid->dirty = false;
+	grid->last_valid = false;
+
+	struct wlr_box *extents = wlr_output_layout_get_box(server->output_layout, NULL);
+	struct wlr_box empty = {};
+	if (extents == NULL)
+		extents = &empty;
+
+	int cols = (extents->width + HIT_GRID_CELL_SIZE - 1) / HIT_GRID_CELL_SIZE;
+	int rows = (extents->height + HIT_GRID_CELL_SIZE - 1) / HIT_GRID_CELL_SIZE;
+
+	if (cols != grid->cols || rows != grid->rows)
+	{
+		hit_grid_release_cells(grid);
+
+		if (cols > 0 && rows > 0)
+		{
+			grid->cells = calloc((size_t) cols * rows, sizeof(*grid->cells));
+			return_if_fail(grid->cells != NULL);
+
+			for (int i = 0; i < cols * rows; i++)
+				wl_array_init(&grid->cells[i]);
+
+			grid->cols = cols;
+			grid->rows = rows;
+		}
+	}
+
+	grid->extents = *extents;
+
+	for (int i = 0; i < grid->cols * grid->rows; i++)
+		grid->cells[i].size = 0;
+
+	/* topmost layer first, and the front of each layer first */
+	for (int i = HOPALONG_LAYER_COUNT - 1; i >= 0; i--)
+	{
+		struct hopalong_view *view;
+
+		wl_list_for_each(view, &server->mapped_layers[i], mapped_link)
+			hit_grid_add_view(grid, view);
+	}
+}
+
+static void
+count_surface(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	int *count = data;
+	(*count)++;
+}
+
+/*
+ * Finds the box in layout coordinates in which a surface of a view is hit
+ * wherever the point is, unless another view is in the way.  That is the
+ * whole surface, if it has no subsurfaces or popups and takes input all
+ * over.  Returns false if there is no such box.
+ */
+static bool
+surface_hit_box(struct hopalong_view *view, struct wlr_surface *surface,
+	double origin_x, double origin_y, struct wlr_box *box)
+{
+	int count = 0;
+	hopalong_view_for_each_surface(view, count_surface, &count);
+	if (count != 1)
+		return false;
+
+	pixman_box32_t rect = {
+		.x2 = surface->current.width,
+		.y2 = surface->current.height,
+	};
+
+	if (pixman_region32_contains_rectangle(&surface->input_region, &rect) != PIXMAN_REGION_IN)
+		return false;
+
+	*box = (struct wlr_box){
+		.x = ceil(origin_x),
+		.y = ceil(origin_y),
+		.width = floor(origin_x + rect.x2) - ceil(origin_x),
+		.height = floor(origin_y + rect.y2) - ceil(origin_y),
+	};
+
+	return box->width > 0 && box->height > 0;
+}
+
+/*
+ * Tells whether the last lookup holds at a point.
+ */
+static bool
+last_hit_contains(struct hopalong_hit_grid *grid, double lx, double ly)
+{
+	/* e.g. button events, which are looked up where the motion before was */
+	if (grid->last_lx == lx && grid->last_ly == ly)
+		return true;
+
+	struct wlr_box *box = &grid->last_box;
+	if (!box->width || !box->height)
+		return false;
+
+	if (lx < box->x || lx >= box->x + box->width ||
+	    ly < box->y || ly >= box->y + box->height)
+		return false;
+
+	/* the views above the last one must all miss the point */
+	int col = floor((lx - grid->extents.x) / HIT_GRID_CELL_SIZE);
+	int row = floor((ly - grid->extents.y) / HIT_GRID_CELL_SIZE);
+
+	if (col < 0 || col >= grid->cols || row < 0 || row >= grid->rows)
+		return false;
+
+	struct hit_grid_entry *entry;
+	wl_array_for_each(entry, &grid->cells[row * grid->cols + col])
+	{
+		if (entry->view == grid->last_view)
+			return true;
+
+		struct wlr_box *above = &entry->box;
+
+		if (lx >= above->x && lx <= above->x + above->width &&
+		    ly >= above->y && ly <= above->y + above->height)
+			return false;
+	}
+
+	return false;
+}
+
+/*
+ * Tells whether a point is outside the box of the surface last found, so
+ * that the pointer may be over another surface now.  If there is no such
+ * box, or anything changed since, this is not known and false is returned.
+ */
+bool
+hopalong_shell_left_last_hit(struct hopalong_server *server, double lx, double ly)
+{
+	return_val_if_fail(server != NULL, false);
+
+	struct hopalong_hit_grid *grid = server->hit_grid;
+	if (grid == NULL || grid->dirty || !grid->last_valid)
+		return false;
+
+	if (!grid->last_box.width || !grid->last_box.height)
+		return false;
+
+	return !last_hit_contains(grid, lx, ly);
+}
+
+/*
+ * Forgets the hit-testing grid, because views moved or were restacked.
+ */
+void
+hopalong_shell_invalidate_hit_grid(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	if (server->hit_grid == NULL)
+		return;
+
+	server->hit_grid->dirty = true;
+	server->hit_grid->last_valid = false;
+}
+
+/*
+ * Forgets the last hit, because a surface changed.
+ */
+void
+hopalong_shell_invalidate_last_hit(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	if (server->hit_grid != NULL)
+		server->hit_grid->last_valid = false;
+}
+
+void
+hopalong_shell_destroy_hit_grid(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	if (server->hit_grid == NULL)
+		return;
+
+	hit_grid_release_cells(server->hit_grid);
+	free(server->hit_grid);
+	server->hit_grid = NULL;
+}
+
 struct hopalong_view *
 hopalong_shell_desktop_view_at(struct hopalong_server *server, double lx, double ly,
 	struct wlr_surface **surface, double *sx, double *sy)
 {
-	struct hopalong_view *view;
+	if (server->hit_grid == NULL)
+	{
+		server->hit_grid = calloc(1, sizeof(*server->hit_grid));
+		return_val_if_fail(server->hit_grid != NULL, NULL);
+
+		server->hit_grid->dirty = true;
+	}
+
+	struct hopalong_hit_grid *grid = server->hit_grid;
 
-	for (size_t i = 0; i < HOPALONG_LAYER_COUNT; i++)
+	if (grid->dirty)
+		hit_grid_rebuild(server, grid);
+
+	if (grid->last_valid && last_hit_contains(grid, lx, ly))
 	{
-		wl_list_for_each(view, &server->mapped_layers[i], mapped_link)
+		struct hopalong_view *view = grid->last_view;
+
+		*surface = grid->last_surface;
+
+		if (*surface != NULL)
+		{
+			*sx = lx - grid->last_origin_x;
+			*sy = ly - grid->last_origin_y;
+		}
+		else if (view != NULL)
+		{
+			view->frame_area = grid->last_frame_area;
+			view->frame_area_edges = grid->last_frame_area_edges;
+		}
+
+		return view;
+	}
+
+	struct hopalong_view *view = NULL;
+	*surface = NULL;
+
+	int col = floor((lx - grid->extents.x) / HIT_GRID_CELL_SIZE);
+	int row = floor((ly - grid->extents.y) / HIT_GRID_CELL_SIZE);
+
+	if (col >= 0 && col < grid->cols && row >= 0 && row < grid->rows)
+	{
+		struct hit_grid_entry *entry;
+
+		wl_array_for_each(entry, &grid->cells[row * grid->cols + col])
 		{
-			if (hopalong_shell_view_at(view, lx, ly, surface, sx, sy))
-				return view;
+			struct wlr_box *box = &entry->box;
+
+			if (lx < box->x || lx > box->x + box->width ||
+			    ly < box->y || ly > box->y + box->height)
+				continue;
+
+			if (hopalong_shell_view_at(entry->view, lx, ly, surface, sx, sy))
+			{
+				view = entry->view;
+				break;
+			}
 		}
 	}
 
-	return NULL;
+	grid->last_valid = true;
+	grid->last_lx = lx;
+	grid->last_ly = ly;
+	grid->last_box = (struct wlr_box){};
+	grid->last_view = view;
+	grid->last_surface = *surface;
+
+	if (*surface != NULL)
+	{
+		grid->last_origin_x = lx - *sx;
+		grid->last_origin_y = ly - *sy;
+
+		surface_hit_box(view, *surface, grid->last_origin_x, grid->last_origin_y, &grid->last_box);
+	}
+	else if (view != NULL)
+	{
+		grid->last_frame_area = view->frame_area;
+		grid->last_frame_area_edges = view->frame_area_edges;
+	}
+
+	return view;
 }
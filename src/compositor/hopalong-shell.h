@@ -20,5 +20,9 @@ extern struct hopalong_view *hopalong_shell_desktop_view_at(struct hopalong_serv
 	struct wlr_surface **surface, double *sx, double *sy);
 extern bool hopalong_shell_view_at(struct hopalong_view *view,
         double lx, double ly, struct wlr_surface **surface, double *sx, double *sy);
+extern void hopalong_shell_invalidate_hit_grid(struct hopalong_server *server);
+extern void hopalong_shell_invalidate_last_hit(struct hopalong_server *server);
+extern bool hopalong_shell_left_last_hit(struct hopalong_server *server, double lx, double ly);
+extern void hopalong_shell_destroy_hit_grid(struct hopalong_server *server);
 
 #endif
\ No newline at end of file
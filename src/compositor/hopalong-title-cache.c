@@ -0,0 +1,189 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hopalong-macros.h"
+#include "hopalong-title-cache.h"
+
+static uint32_t
+hash_text(const char *text)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+
+	for (; *text; text++)
+	{
+		hash ^= (uint8_t) *text;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static bool
+entry_matches(const struct hopalong_title_cache_entry *entry, uint32_t hash, const char *text, float scale, int max_width)
+{
+	if (entry->hash != hash || entry->scale != scale || strcmp(entry->text, text))
+		return false;
+
+	if (entry->max_width == max_width)
+		return true;
+
+	/* a title which was not cut off looks the same in any title bar wide enough */
+	return !entry->ellipsized && entry->width <= max_width;
+}
+
+/*
+ * Looks up a rendered title, and takes a reference to it if there is one.
+ */
+struct hopalong_title_cache_entry *
+hopalong_title_cache_lookup(struct hopalong_title_cache *cache, const char *text, float scale, int max_width)
+{
+	return_val_if_fail(cache != NULL, NULL);
+	return_val_if_fail(text != NULL, NULL);
+
+	uint32_t hash = hash_text(text);
+
+	struct hopalong_title_cache_entry *entry;
+	wl_list_for_each(entry, &cache->entries, link)
+	{
+		if (!entry_matches(entry, hash, text, scale, max_width))
+			continue;
+
+		entry->refcount++;
+		return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Adds a rendered title to the cache, holding one reference to it.  If the
+ * caller holds the only reference to an entry it no longer needs, passing it
+ * as reuse lets the new title take over its place in the atlas.  The
+ * reference to reuse is given up, unless adding the title fails.
+ */
+struct hopalong_title_cache_entry *
+hopalong_title_cache_insert(struct hopalong_title_cache *cache, struct hopalong_title_cache_entry *reuse,
+	const char *text, float scale, int max_width, const void *data, int stride, int width, int height, bool ellipsized)
+{
+	return_val_if_fail(cache != NULL, NULL);
+	return_val_if_fail(text != NULL, NULL);
+
+	char *key = strdup(text);
+	return_val_if_fail(key != NULL, NULL);
+
+	struct hopalong_title_cache_entry *entry = reuse;
+	struct hopalong_atlas_entry *mask = NULL;
+
+	if (entry != NULL && entry->refcount == 1)
+	{
+		wl_list_remove(&entry->link);
+		free(entry->text);
+
+		mask = entry->mask;
+	}
+	else
+	{
+		entry = calloc(1, sizeof(*entry));
+		if (entry == NULL)
+		{
+			free(key);
+			return NULL;
+		}
+
+		if (reuse != NULL)
+			hopalong_title_cache_unref(cache, reuse);
+	}
+
+	*entry = (struct hopalong_title_cache_entry){
+		.refcount = 1,
+		.hash = hash_text(key),
+		.text = key,
+		.scale = scale,
+		.max_width = max_width,
+		.ellipsized = ellipsized,
+	};
+
+	if (data != NULL)
+	{
+		entry->mask = hopalong_atlas_update(cache->atlas, mask, data, stride, width, height);
+
+		entry->width = ceilf(width / scale);
+		entry->height = ceilf(height / scale);
+	}
+	else if (mask != NULL)
+		hopalong_atlas_remove(cache->atlas, mask);
+
+	wl_list_insert(&cache->entries, &entry->link);
+
+	return entry;
+}
+
+/*
+ * Drops a reference to a rendered title, freeing it with the last one.
+ */
+void
+hopalong_title_cache_unref(struct hopalong_title_cache *cache, struct hopalong_title_cache_entry *entry)
+{
+	return_if_fail(cache != NULL);
+	return_if_fail(entry != NULL);
+
+	if (--entry->refcount > 0)
+		return;
+
+	if (entry->mask != NULL)
+		hopalong_atlas_remove(cache->atlas, entry->mask);
+
+	wl_list_remove(&entry->link);
+	free(entry->text);
+	free(entry);
+}
+
+/*
+ * Creates an empty cache, keeping titles in the given atlas.
+ */
+struct hopalong_title_cache *
+hopalong_title_cache_new(struct hopalong_atlas *atlas)
+{
+	return_val_if_fail(atlas != NULL, NULL);
+
+	struct hopalong_title_cache *cache = calloc(1, sizeof(*cache));
+	return_val_if_fail(cache != NULL, NULL);
+
+	cache->atlas = atlas;
+	wl_list_init(&cache->entries);
+
+	return cache;
+}
+
+/*
+ * Destroys the cache.  The atlas images of the titles go away with the atlas.
+ */
+void
+hopalong_title_cache_destroy(struct hopalong_title_cache *cache)
+{
+	return_if_fail(cache != NULL);
+
+	struct hopalong_title_cache_entry *entry, *next;
+	wl_list_for_each_safe(entry, next, &cache->entries, link)
+	{
+		wl_list_remove(&entry->link);
+		free(entry->text);
+		free(entry);
+	}
+
+	free(cache);
+}
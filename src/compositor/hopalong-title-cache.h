@@ -0,0 +1,57 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#ifndef HOPALONG_COMPOSITOR_TITLE_CACHE_H
+#define HOPALONG_COMPOSITOR_TITLE_CACHE_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+#include "hopalong-atlas.h"
+
+/*
+ * A rendered title, shared by all views showing the same text at the same
+ * scale and width.  All titles use the same font and are kept as coverage
+ * masks, so the text, scale and width the title was ellipsized to are all
+ * there is to the key.
+ */
+struct hopalong_title_cache_entry {
+	struct wl_list link;
+	int refcount;
+
+	uint32_t hash;
+	char *text;
+	float scale;
+	int max_width;
+
+	/* the result: the mask is NULL if there was nothing to draw */
+	struct hopalong_atlas_entry *mask;
+	int width, height;
+	bool ellipsized;
+};
+
+struct hopalong_title_cache {
+	struct hopalong_atlas *atlas;
+	struct wl_list entries;
+};
+
+extern struct hopalong_title_cache *hopalong_title_cache_new(struct hopalong_atlas *atlas);
+extern void hopalong_title_cache_destroy(struct hopalong_title_cache *cache);
+extern struct hopalong_title_cache_entry *hopalong_title_cache_lookup(struct hopalong_title_cache *cache,
+	const char *text, float scale, int max_width);
+extern struct hopalong_title_cache_entry *hopalong_title_cache_insert(struct hopalong_title_cache *cache,
+	struct hopalong_title_cache_entry *reuse, const char *text, float scale, int max_width,
+	const void *data, int stride, int width, int height, bool ellipsized);
+extern void hopalong_title_cache_unref(struct hopalong_title_cache *cache, struct hopalong_title_cache_entry *entry);
+
+#endif
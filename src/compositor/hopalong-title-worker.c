@@ -0,0 +1,351 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hopalong-server.h"
+#include "hopalong-pango-util.h"
+#include "hopalong-title-worker.h"
+
+/* height of the title images, in layout coordinates */
+#define TITLE_HEIGHT	(32)
+
+/*
+ * Creates a job rendering text for a view, at most max_width layout pixels
+ * wide.  The scales to render it at are added by the caller.
+ */
+struct hopalong_title_job *
+hopalong_title_job_new(struct hopalong_view *view, const char *text, int max_width)
+{
+	return_val_if_fail(view != NULL, NULL);
+	return_val_if_fail(text != NULL, NULL);
+
+	struct hopalong_title_job *job = calloc(1, sizeof(*job));
+	return_val_if_fail(job != NULL, NULL);
+
+	job->text = strdup(text);
+	if (job->text == NULL)
+	{
+		free(job);
+		return NULL;
+	}
+
+	job->view = view;
+	job->max_width = max_width;
+
+	return job;
+}
+
+void
+hopalong_title_job_free(struct hopalong_title_job *job)
+{
+	return_if_fail(job != NULL);
+
+	for (size_t i = 0; i < job->nimages; i++)
+	{
+		if (job->images[i].surface != NULL)
+			cairo_surface_destroy(job->images[i].surface);
+	}
+
+	free(job->text);
+	free(job);
+}
+
+static cairo_surface_t *
+render_title_image(PangoLayout *layout, const char *text, int max_width, float scale, bool *ellipsized)
+{
+	/* no room for the title until the view is made wider */
+	if (max_width <= 0)
+	{
+		*ellipsized = true;
+		return NULL;
+	}
+
+	/* only rasterize as much of the title as fits into the title bar */
+	pango_layout_set_width(layout, max_width * scale * PANGO_SCALE);
+
+	/* titles come from clients, so they are plain text and never markup */
+	int w = 0;
+	hopalong_pango_util_layout_set_text(layout, text, scale, false, &w, NULL);
+	if (w <= 0)
+		return NULL;
+
+	if (pango_layout_is_ellipsized(layout))
+		*ellipsized = true;
+
+	/* the font is scaled with the output, and so is the image */
+	int h = ceilf(TITLE_HEIGHT * scale);
+
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	return_val_if_fail(surface != NULL, NULL);
+
+	cairo_t *cr = cairo_create(surface);
+	cairo_move_to(cr, 0, 0);
+
+	/* white text is a coverage mask, which is tinted when it is drawn */
+	cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, 1.0);
+	pango_cairo_show_layout(cr, layout);
+	cairo_surface_flush(surface);
+
+	cairo_destroy(cr);
+
+	return surface;
+}
+
+static void
+render_title_job(PangoLayout *layout, struct hopalong_title_job *job)
+{
+	for (size_t i = 0; i < job->nimages; i++)
+	{
+		struct hopalong_title_image *image = &job->images[i];
+
+		image->surface = render_title_image(layout, job->text, job->max_width,
+			image->scale, &image->ellipsized);
+	}
+}
+
+static void
+complete_job(struct hopalong_title_job *job)
+{
+	if (job->view != NULL)
+		hopalong_view_finish_title(job->view, job);
+
+	hopalong_title_job_free(job);
+}
+
+static void *
+hopalong_title_worker_thread(void *data)
+{
+	struct hopalong_title_worker *worker = data;
+
+	/* Pango objects must not be shared between threads */
+	struct hopalong_pango_font *font = hopalong_pango_util_font_new(worker->font);
+	PangoLayout *layout = font != NULL ? hopalong_pango_util_layout_new(font) : NULL;
+
+	if (layout != NULL)
+		pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
+
+	pthread_mutex_lock(&worker->lock);
+
+	while (!worker->stopping)
+	{
+		if (wl_list_empty(&worker->pending))
+		{
+			pthread_cond_wait(&worker->cond, &worker->lock);
+			continue;
+		}
+
+		struct hopalong_title_job *job = wl_container_of(worker->pending.next, job, link);
+		wl_list_remove(&job->link);
+
+		pthread_mutex_unlock(&worker->lock);
+
+		if (layout != NULL)
+			render_title_job(layout, job);
+
+		pthread_mutex_lock(&worker->lock);
+
+		wl_list_insert(worker->done.prev, &job->link);
+
+		/* wake up the main thread */
+		char c = 0;
+		if (write(worker->notify_fds[1], &c, 1) < 0 && errno != EAGAIN)
+			wlr_log_errno(WLR_ERROR, "Failed to notify the main thread of a finished title");
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	if (layout != NULL)
+		g_object_unref(layout);
+
+	if (font != NULL)
+		hopalong_pango_util_font_destroy(font);
+
+	return NULL;
+}
+
+static int
+hopalong_title_worker_notify(int fd, uint32_t mask, void *data)
+{
+	struct hopalong_title_worker *worker = data;
+	return_val_if_fail(worker != NULL, 0);
+
+	char buf[64];
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	struct wl_list done;
+	wl_list_init(&done);
+
+	pthread_mutex_lock(&worker->lock);
+	wl_list_insert_list(&done, &worker->done);
+	wl_list_init(&worker->done);
+	pthread_mutex_unlock(&worker->lock);
+
+	struct hopalong_title_job *job, *next;
+	wl_list_for_each_safe(job, next, &done, link)
+	{
+		wl_list_remove(&job->link);
+		complete_job(job);
+	}
+
+	return 0;
+}
+
+/*
+ * Hands a job to the worker threads.  The view is told once it is done.
+ */
+void
+hopalong_title_worker_submit(struct hopalong_title_worker *worker, struct hopalong_title_job *job)
+{
+	return_if_fail(worker != NULL);
+	return_if_fail(job != NULL);
+
+	if (worker->nthreads == 0)
+	{
+		if (worker->layout == NULL)
+		{
+			worker->layout = hopalong_pango_util_layout_new(worker->server->title_font);
+			if (worker->layout != NULL)
+				pango_layout_set_ellipsize(worker->layout, PANGO_ELLIPSIZE_END);
+		}
+
+		if (worker->layout != NULL)
+			render_title_job(worker->layout, job);
+
+		complete_job(job);
+		return;
+	}
+
+	pthread_mutex_lock(&worker->lock);
+	wl_list_insert(worker->pending.prev, &job->link);
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+static bool
+set_cloexec_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFD);
+	if (flags < 0 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0)
+		return false;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return false;
+
+	return true;
+}
+
+/*
+ * Starts the worker threads rendering titles in the given font.
+ */
+struct hopalong_title_worker *
+hopalong_title_worker_new(struct hopalong_server *server, const char *font)
+{
+	return_val_if_fail(server != NULL, NULL);
+	return_val_if_fail(font != NULL, NULL);
+
+	struct hopalong_title_worker *worker = calloc(1, sizeof(*worker));
+	return_val_if_fail(worker != NULL, NULL);
+
+	worker->server = server;
+	worker->notify_fds[0] = worker->notify_fds[1] = -1;
+
+	worker->font = strdup(font);
+	if (worker->font == NULL)
+	{
+		free(worker);
+		return NULL;
+	}
+
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_cond_init(&worker->cond, NULL);
+	wl_list_init(&worker->pending);
+	wl_list_init(&worker->done);
+
+	if (pipe(worker->notify_fds) < 0 || !set_cloexec_nonblock(worker->notify_fds[0]) ||
+	    !set_cloexec_nonblock(worker->notify_fds[1]))
+	{
+		wlr_log_errno(WLR_ERROR, "Failed to create title worker pipe, rendering titles synchronously");
+		return worker;
+	}
+
+	worker->notify_source = wl_event_loop_add_fd(wl_display_get_event_loop(server->display),
+		worker->notify_fds[0], WL_EVENT_READABLE, hopalong_title_worker_notify, worker);
+	if (worker->notify_source == NULL)
+		return worker;
+
+	for (size_t i = 0; i < HOPALONG_TITLE_WORKER_THREADS; i++)
+	{
+		if (pthread_create(&worker->threads[i], NULL, hopalong_title_worker_thread, worker) != 0)
+			break;
+
+		worker->nthreads++;
+	}
+
+	if (worker->nthreads == 0)
+		wlr_log(WLR_ERROR, "Failed to start title worker threads, rendering titles synchronously");
+
+	return worker;
+}
+
+/*
+ * Stops the worker threads, and drops the jobs they did not finish.
+ */
+void
+hopalong_title_worker_destroy(struct hopalong_title_worker *worker)
+{
+	return_if_fail(worker != NULL);
+
+	pthread_mutex_lock(&worker->lock);
+	worker->stopping = true;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	for (size_t i = 0; i < worker->nthreads; i++)
+		pthread_join(worker->threads[i], NULL);
+
+	wl_list_insert_list(&worker->pending, &worker->done);
+
+	struct hopalong_title_job *job, *next;
+	wl_list_for_each_safe(job, next, &worker->pending, link)
+	{
+		if (job->view != NULL)
+			job->view->title_job = NULL;
+
+		wl_list_remove(&job->link);
+		hopalong_title_job_free(job);
+	}
+
+	if (worker->notify_source != NULL)
+		wl_event_source_remove(worker->notify_source);
+
+	for (size_t i = 0; i < 2; i++)
+	{
+		if (worker->notify_fds[i] >= 0)
+			close(worker->notify_fds[i]);
+	}
+
+	if (worker->layout != NULL)
+		g_object_unref(worker->layout);
+
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->lock);
+	free(worker->font);
+	free(worker);
+}
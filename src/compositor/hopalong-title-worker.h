@@ -0,0 +1,83 @@
+/*
+ * Hopalong - a friendly Wayland compositor
+ * Copyright (c) 2020 Ariadne Conill <ariadne@dereferenced.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#ifndef HOPALONG_COMPOSITOR_TITLE_WORKER_H
+#define HOPALONG_COMPOSITOR_TITLE_WORKER_H
+
+#include <pthread.h>
+#include <cairo/cairo.h>
+#include <wayland-server-core.h>
+
+#include "hopalong-view.h"
+
+#define HOPALONG_TITLE_WORKER_THREADS	(2)
+
+struct hopalong_title_image {
+	float scale;
+
+	/* the rendered coverage mask, NULL if there was nothing to draw */
+	cairo_surface_t *surface;
+	bool ellipsized;
+};
+
+/*
+ * A title to be shaped and rasterized off the main thread.  Only the main
+ * thread touches view; the workers only read the text and fill in images.
+ */
+struct hopalong_title_job {
+	struct wl_list link;
+
+	/* the view the title is for, NULL once it is not wanted anymore */
+	struct hopalong_view *view;
+
+	char *text;
+	int max_width;
+
+	size_t nimages;
+	struct hopalong_title_image images[HOPALONG_VIEW_MAX_SCALES];
+};
+
+/*
+ * Titles are rendered by a small pool of threads, each with its own Pango
+ * context.  Finished jobs are handed back to the main thread through a
+ * pipe watched by the event loop, which then uploads them to the atlas.
+ * If no thread can be started, titles are rendered synchronously.
+ */
+struct hopalong_title_worker {
+	struct hopalong_server *server;
+	char *font;
+
+	pthread_t threads[HOPALONG_TITLE_WORKER_THREADS];
+	size_t nthreads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct wl_list pending;
+	struct wl_list done;
+	bool stopping;
+
+	int notify_fds[2];
+	struct wl_event_source *notify_source;
+
+	/* only used when rendering synchronously */
+	PangoLayout *layout;
+};
+
+extern struct hopalong_title_worker *hopalong_title_worker_new(struct hopalong_server *server, const char *font);
+extern void hopalong_title_worker_destroy(struct hopalong_title_worker *worker);
+extern void hopalong_title_worker_submit(struct hopalong_title_worker *worker, struct hopalong_title_job *job);
+
+extern struct hopalong_title_job *hopalong_title_job_new(struct hopalong_view *view, const char *text, int max_width);
+extern void hopalong_title_job_free(struct hopalong_title_job *job);
+
+#endif
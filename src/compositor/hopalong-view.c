@@ -11,6 +11,7 @@
  * from the use of this software.
  */
 
+#include <time.h>
 #include <cairo/cairo.h>
 #include <pango/pangocairo.h>
 
@@ -18,16 +19,34 @@
 #include "hopalong-view.h"
 #include "hopalong-output.h"
 #include "hopalong-pango-util.h"
+#include "hopalong-decoration.h"
+#include "hopalong-title-worker.h"
+#include "hopalong-title-cache.h"
+#include "hopalong-shell.h"
 
-static struct wlr_texture *
-generate_minimize_texture(struct hopalong_output *output, const float color[4])
+/* size of the title bar buttons, in layout coordinates */
+#define BUTTON_SIZE	(16)
+
+/* how often titles of background views are rendered at most */
+#define TITLE_THROTTLE_MSEC	(250)
+
+/* how long to wait for a client to follow an interactive resize */
+#define RESIZE_TIMEOUT_MSEC	(200)
+
+static struct hopalong_atlas_entry *
+generate_minimize_texture(struct hopalong_atlas *atlas, const float color[4], float scale)
 {
-	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 32, 32);
+	int size = BUTTON_SIZE * scale;
+
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
 	return_val_if_fail(surface != NULL, false);
 
 	cairo_t *cr = cairo_create(surface);
 	return_val_if_fail(cr != NULL, false);
 
+	/* the icons are drawn on a 32x32 grid */
+	cairo_scale(cr, size / 32.0, size / 32.0);
+
 	cairo_set_antialias(cr, CAIRO_ANTIALIAS_BEST);
 
 	cairo_set_source_rgba(cr, color[0], color[1], color[2], color[3]);
@@ -42,11 +61,8 @@ generate_minimize_texture(struct hopalong_output *output, const float color[4])
 	cairo_surface_flush(surface);
 
 	unsigned char *data = cairo_image_surface_get_data(surface);
-	struct wlr_renderer *renderer = output->wlr_output->renderer;
-	struct wlr_texture *texture = wlr_texture_from_pixels(renderer,
-		WL_SHM_FORMAT_ARGB8888,
-		cairo_image_surface_get_stride(surface),
-		32, 32, data);
+	struct hopalong_atlas_entry *texture = hopalong_atlas_add(atlas, data,
+		cairo_image_surface_get_stride(surface), size, size);
 
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
@@ -54,15 +70,20 @@ generate_minimize_texture(struct hopalong_output *output, const float color[4])
 	return texture;
 }
 
-static struct wlr_texture *
-generate_maximize_texture(struct hopalong_output *output, const float color[4])
+static struct hopalong_atlas_entry *
+generate_maximize_texture(struct hopalong_atlas *atlas, const float color[4], float scale)
 {
-	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 32, 32);
+	int size = BUTTON_SIZE * scale;
+
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
 	return_val_if_fail(surface != NULL, false);
 
 	cairo_t *cr = cairo_create(surface);
 	return_val_if_fail(cr != NULL, false);
 
+	/* the icons are drawn on a 32x32 grid */
+	cairo_scale(cr, size / 32.0, size / 32.0);
+
 	cairo_set_antialias(cr, CAIRO_ANTIALIAS_BEST);
 
 	cairo_set_source_rgba(cr, color[0], color[1], color[2], color[3]);
@@ -79,11 +100,8 @@ generate_maximize_texture(struct hopalong_output *output, const float color[4])
 	cairo_surface_flush(surface);
 
 	unsigned char *data = cairo_image_surface_get_data(surface);
-	struct wlr_renderer *renderer = output->wlr_output->renderer;
-	struct wlr_texture *texture = wlr_texture_from_pixels(renderer,
-		WL_SHM_FORMAT_ARGB8888,
-		cairo_image_surface_get_stride(surface),
-		32, 32, data);
+	struct hopalong_atlas_entry *texture = hopalong_atlas_add(atlas, data,
+		cairo_image_surface_get_stride(surface), size, size);
 
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
@@ -91,15 +109,20 @@ generate_maximize_texture(struct hopalong_output *output, const float color[4])
 	return texture;
 }
 
-static struct wlr_texture *
-generate_close_texture(struct hopalong_output *output, const float color[4])
+static struct hopalong_atlas_entry *
+generate_close_texture(struct hopalong_atlas *atlas, const float color[4], float scale)
 {
-	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 32, 32);
+	int size = BUTTON_SIZE * scale;
+
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
 	return_val_if_fail(surface != NULL, false);
 
 	cairo_t *cr = cairo_create(surface);
 	return_val_if_fail(cr != NULL, false);
 
+	/* the icons are drawn on a 32x32 grid */
+	cairo_scale(cr, size / 32.0, size / 32.0);
+
 	cairo_set_antialias(cr, CAIRO_ANTIALIAS_BEST);
 
 	cairo_set_source_rgba(cr, color[0], color[1], color[2], color[3]);
@@ -116,11 +139,8 @@ generate_close_texture(struct hopalong_output *output, const float color[4])
 	cairo_surface_flush(surface);
 
 	unsigned char *data = cairo_image_surface_get_data(surface);
-	struct wlr_renderer *renderer = output->wlr_output->renderer;
-	struct wlr_texture *texture = wlr_texture_from_pixels(renderer,
-		WL_SHM_FORMAT_ARGB8888,
-		cairo_image_surface_get_stride(surface),
-		32, 32, data);
+	struct hopalong_atlas_entry *texture = hopalong_atlas_add(atlas, data,
+		cairo_image_surface_get_stride(surface), size, size);
 
 	cairo_destroy(cr);
 	cairo_surface_destroy(surface);
@@ -128,36 +148,277 @@ generate_close_texture(struct hopalong_output *output, const float color[4])
 	return texture;
 }
 
+/*
+ * Returns the title bar buttons rendered at the given scale, drawing them
+ * into the decoration atlas first if no output used that scale before.
+ * All outputs of the same scale share them.
+ */
 struct hopalong_generated_textures *
-hopalong_generate_builtin_textures_for_output(struct hopalong_output *output, const struct hopalong_style *style)
+hopalong_generated_textures_for_scale(struct hopalong_server *server, float scale)
 {
-	struct hopalong_generated_textures *gentex = calloc(1, sizeof(*gentex));
+	return_val_if_fail(server != NULL, NULL);
+
+	struct hopalong_generated_textures *gentex;
+	wl_list_for_each(gentex, &server->generated_textures, link)
+	{
+		if (gentex->scale == scale)
+			return gentex;
+	}
 
-	gentex->minimize = generate_minimize_texture(output, style->minimize_btn_fg);
-	gentex->minimize_inactive = generate_minimize_texture(output, style->minimize_btn_fg_inactive);
+	gentex = calloc(1, sizeof(*gentex));
+	return_val_if_fail(gentex != NULL, NULL);
 
-	gentex->maximize = generate_maximize_texture(output, style->maximize_btn_fg);
-	gentex->maximize_inactive = generate_maximize_texture(output, style->maximize_btn_fg_inactive);
+	const struct hopalong_style *style = server->style;
+	struct hopalong_atlas *atlas = server->atlas;
 
-	gentex->close = generate_close_texture(output, style->close_btn_fg);
-	gentex->close_inactive = generate_close_texture(output, style->close_btn_fg_inactive);
+	gentex->scale = scale;
+
+	gentex->minimize = generate_minimize_texture(atlas, style->minimize_btn_fg, scale);
+	gentex->minimize_inactive = generate_minimize_texture(atlas, style->minimize_btn_fg_inactive, scale);
+
+	gentex->maximize = generate_maximize_texture(atlas, style->maximize_btn_fg, scale);
+	gentex->maximize_inactive = generate_maximize_texture(atlas, style->maximize_btn_fg_inactive, scale);
+
+	gentex->close = generate_close_texture(atlas, style->close_btn_fg, scale);
+	gentex->close_inactive = generate_close_texture(atlas, style->close_btn_fg_inactive, scale);
+
+	wl_list_insert(&server->generated_textures, &gentex->link);
 
 	return gentex;
 }
 
-static bool
-hopalong_view_generate_title_texture(struct hopalong_output *output, struct hopalong_view *view)
+static void
+remove_button_texture(struct hopalong_atlas *atlas, struct hopalong_atlas_entry *entry)
+{
+	if (entry != NULL)
+		hopalong_atlas_remove(atlas, entry);
+}
+
+/*
+ * Frees the button textures for scales no output uses anymore, e.g. after
+ * an output was unplugged, so that they do not take up atlas space.
+ */
+void
+hopalong_generated_textures_prune(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	struct hopalong_generated_textures *gentex, *next;
+	wl_list_for_each_safe(gentex, next, &server->generated_textures, link)
+	{
+		bool used = false;
+
+		struct hopalong_output *output;
+		wl_list_for_each(output, &server->outputs, link)
+		{
+			if (output->wlr_output->scale == gentex->scale)
+				used = true;
+		}
+
+		if (used)
+			continue;
+
+		remove_button_texture(server->atlas, gentex->minimize);
+		remove_button_texture(server->atlas, gentex->minimize_inactive);
+		remove_button_texture(server->atlas, gentex->maximize);
+		remove_button_texture(server->atlas, gentex->maximize_inactive);
+		remove_button_texture(server->atlas, gentex->close);
+		remove_button_texture(server->atlas, gentex->close_inactive);
+
+		wl_list_remove(&gentex->link);
+		free(gentex);
+	}
+}
+
+/*
+ * Frees the button textures for all scales.
+ */
+void
+hopalong_generated_textures_destroy_all(struct hopalong_server *server)
 {
-	struct wlr_renderer *renderer = output->wlr_output->renderer;
+	return_if_fail(server != NULL);
 
-	if (view->title)
+	struct hopalong_generated_textures *gentex, *next;
+	wl_list_for_each_safe(gentex, next, &server->generated_textures, link)
 	{
-		wlr_texture_destroy(view->title);
-		wlr_texture_destroy(view->title_inactive);
+		wl_list_remove(&gentex->link);
+		free(gentex);
 	}
+}
 
-	const struct hopalong_style *style = view->server->style;
-	const char *font = style->title_bar_font;
+/*
+ * Drops the references to the rendered titles of a view.
+ */
+static void
+hopalong_view_release_title(struct hopalong_view *view)
+{
+	for (size_t i = 0; i < view->ntitles; i++)
+		hopalong_title_cache_unref(view->server->title_cache, view->titles[i].cached);
+
+	view->ntitles = 0;
+	view->title_box = (struct wlr_box){};
+}
+
+/*
+ * Shows a new set of rendered titles, whose references the view takes over.
+ */
+static void
+hopalong_view_set_titles(struct hopalong_view *view, const struct hopalong_view_title *titles, size_t ntitles)
+{
+	hopalong_view_release_title(view);
+
+	view->title_ellipsized = false;
+
+	for (size_t i = 0; i < ntitles; i++)
+	{
+		const struct hopalong_title_cache_entry *cached = titles[i].cached;
+
+		view->titles[view->ntitles++] = titles[i];
+
+		/* the layout reserves room for the title at its largest */
+		if (view->title_box.width < cached->width)
+			view->title_box.width = cached->width;
+		if (view->title_box.height < cached->height)
+			view->title_box.height = cached->height;
+
+		if (cached->ellipsized)
+			view->title_ellipsized = true;
+	}
+
+	hopalong_decoration_invalidate(view);
+	hopalong_view_damage_whole(view);
+}
+
+/*
+ * Returns the title of a view as rendered at the given scale, if it was.
+ */
+const struct hopalong_view_title *
+hopalong_view_get_title(struct hopalong_view *view, float scale)
+{
+	return_val_if_fail(view != NULL, NULL);
+
+	for (size_t i = 0; i < view->ntitles; i++)
+	{
+		if (view->titles[i].scale == scale)
+			return &view->titles[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Puts the title images rendered by a job into the title cache, replacing
+ * the ones shown until now.  Titles someone else rendered meanwhile are
+ * used instead.
+ */
+void
+hopalong_view_finish_title(struct hopalong_view *view, struct hopalong_title_job *job)
+{
+	return_if_fail(view != NULL);
+	return_if_fail(job != NULL);
+
+	struct hopalong_title_cache *cache = view->server->title_cache;
+
+	view->title_job = NULL;
+
+	struct hopalong_view_title titles[HOPALONG_VIEW_MAX_SCALES];
+	size_t ntitles = 0;
+
+	for (size_t i = 0; i < job->nimages; i++)
+	{
+		const struct hopalong_title_image *image = &job->images[i];
+
+		struct hopalong_title_cache_entry *cached = hopalong_title_cache_lookup(cache,
+			job->text, image->scale, job->max_width);
+
+		if (cached == NULL)
+		{
+			/* an old title only this view shows is overwritten in place */
+			struct hopalong_title_cache_entry *reuse = NULL;
+			for (size_t j = 0; j < view->ntitles; j++)
+			{
+				if (view->titles[j].scale == image->scale && view->titles[j].cached->refcount == 1)
+				{
+					reuse = view->titles[j].cached;
+					view->titles[j] = view->titles[--view->ntitles];
+					break;
+				}
+			}
+
+			cairo_surface_t *surface = image->surface;
+			cached = hopalong_title_cache_insert(cache, reuse, job->text, image->scale, job->max_width,
+				surface ? cairo_image_surface_get_data(surface) : NULL,
+				surface ? cairo_image_surface_get_stride(surface) : 0,
+				surface ? cairo_image_surface_get_width(surface) : 0,
+				surface ? cairo_image_surface_get_height(surface) : 0,
+				image->ellipsized);
+
+			if (cached == NULL)
+			{
+				/* the old title was taken off the view, and nothing holds it anymore */
+				if (reuse != NULL)
+					hopalong_title_cache_unref(cache, reuse);
+
+				continue;
+			}
+		}
+
+		titles[ntitles++] = (struct hopalong_view_title){
+			.scale = image->scale,
+			.cached = cached,
+		};
+	}
+
+	hopalong_view_set_titles(view, titles, ntitles);
+}
+
+/*
+ * Adds the scales of the outputs showing a view to a title job, or of all
+ * outputs if visible_only is false.
+ */
+static void
+add_title_scales(struct hopalong_view *view, struct hopalong_title_job *job, bool visible_only)
+{
+	struct hopalong_server *server = view->server;
+
+	struct hopalong_output *output;
+	wl_list_for_each(output, &server->outputs, link)
+	{
+		float scale = output->wlr_output->scale;
+		bool found = false;
+
+		if (visible_only && !wlr_output_layout_intersects(server->output_layout, output->wlr_output, &view->bounds))
+			continue;
+
+		for (size_t i = 0; i < job->nimages; i++)
+		{
+			if (job->images[i].scale == scale)
+				found = true;
+		}
+
+		if (found)
+			continue;
+
+		if (job->nimages == HOPALONG_VIEW_MAX_SCALES)
+			break;
+
+		job->images[job->nimages++].scale = scale;
+	}
+}
+
+/*
+ * Has the title of a view rendered once for every scale in use by an
+ * output showing it.  Outputs the view moves onto later ask for their
+ * scale when drawing it.  The current title stays up until the new one
+ * is done.
+ */
+bool
+hopalong_view_generate_textures(struct hopalong_view *view)
+{
+	return_val_if_fail(view != NULL, false);
+
+	if (!view->title_dirty)
+		return true;
 
 	char title[4096] = {};
 
@@ -167,84 +428,179 @@ hopalong_view_generate_title_texture(struct hopalong_output *output, struct hopa
 	if (title_data != NULL)
 		strlcpy(title, title_data, sizeof title);
 
-	float scale = output->wlr_output->scale;
-	int w = 400;
-	int h = 32;
+	int max_width = hopalong_decoration_get_title_width(view);
 
-	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
-	return_val_if_fail(surface != NULL, false);
+	/* the title stays dirty if there is no memory to render it */
+	struct hopalong_title_job *job = hopalong_title_job_new(view, title, max_width);
+	return_val_if_fail(job != NULL, false);
 
-	cairo_t *cr = cairo_create(surface);
-	return_val_if_fail(cr != NULL, false);
+	view->title_max_width = max_width;
+	view->title_dirty = false;
+	view->title_pending = false;
 
-	cairo_set_antialias(cr, CAIRO_ANTIALIAS_BEST);
-	cairo_font_options_t *fo = cairo_font_options_create();
-	return_val_if_fail(fo != NULL, false);
+	add_title_scales(view, job, true);
 
-	cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
-	cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_GRAY);
+	/* not laid out yet, or off screen */
+	if (job->nimages == 0)
+		add_title_scales(view, job, false);
 
-	cairo_set_font_options(cr, fo);
-	hopalong_pango_util_get_text_size(cr, font, &w, NULL, NULL, scale, true, "%s", title);
-	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+	/* titles shown by other views already need no rendering */
+	struct hopalong_view_title titles[HOPALONG_VIEW_MAX_SCALES];
+	size_t ntitles = 0;
 
-	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
-	return_val_if_fail(surface != NULL, false);
+	for (size_t i = 0; i < job->nimages; i++)
+	{
+		struct hopalong_title_cache_entry *cached = hopalong_title_cache_lookup(view->server->title_cache,
+			title, job->images[i].scale, job->max_width);
 
-	cr = cairo_create(surface);
-	return_val_if_fail(cr != NULL, false);
+		if (cached == NULL)
+			break;
 
-	PangoContext *pango = pango_cairo_create_context(cr);
-	cairo_move_to(cr, 0, 0);
+		titles[ntitles++] = (struct hopalong_view_title){
+			.scale = job->images[i].scale,
+			.cached = cached,
+		};
+	}
 
-	/* active color first */
-	cairo_set_source_rgba(cr, style->title_bar_fg[0], style->title_bar_fg[1],
-			      style->title_bar_fg[2], style->title_bar_fg[3]);
-	hopalong_pango_util_printf(cr, font, scale, true, "%s", title);
-	cairo_surface_flush(surface);
+	if (ntitles == job->nimages)
+	{
+		hopalong_title_job_free(job);
+		hopalong_view_set_titles(view, titles, ntitles);
+		return true;
+	}
 
-	unsigned char *data = cairo_image_surface_get_data(surface);
+	for (size_t i = 0; i < ntitles; i++)
+		hopalong_title_cache_unref(view->server->title_cache, titles[i].cached);
 
-	view->title = wlr_texture_from_pixels(renderer,
-		WL_SHM_FORMAT_ARGB8888,
-		cairo_image_surface_get_stride(surface),
-		w, h, data);
+	view->title_job = job;
+	hopalong_title_worker_submit(view->server->title_worker, job);
 
-	/* inactive color */
-	cairo_set_source_rgba(cr, style->title_bar_fg_inactive[0], style->title_bar_fg_inactive[1],
-			      style->title_bar_fg_inactive[2], style->title_bar_fg_inactive[3]);
-	hopalong_pango_util_printf(cr, font, scale, true, "%s", title);
-	cairo_surface_flush(surface);
+	return true;
+}
 
-	data = cairo_image_surface_get_data(surface);
+/*
+ * Marks the title of a view as changed.  Mapped views are queued for their
+ * title to be rendered again before the next frame; unmapped views are
+ * queued once they are mapped.
+ */
+void
+hopalong_view_set_title_dirty(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
 
-	view->title_inactive = wlr_texture_from_pixels(renderer,
-		WL_SHM_FORMAT_ARGB8888,
-		cairo_image_surface_get_stride(surface),
-		w, h, data);
+	view->title_dirty = true;
 
-	view->title_box.width = w;
-	view->title_box.height = h;
-	view->title_dirty = false;
+	if (!view->mapped || view->title_queued)
+		return;
 
-	g_object_unref(pango);
-	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+	wl_list_insert(view->server->dirty_titles.prev, &view->title_link);
+	view->title_queued = true;
+}
 
-	return true;
+/*
+ * Called when a client changes the title of a view.  Only the latest title
+ * is rendered, before the next frame; titles set in between are dropped.
+ */
+void
+hopalong_view_title_changed(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
+
+	/* the client's last title was never rendered */
+	if (view->title_pending)
+		view->server->title_updates_dropped++;
+
+	view->title_pending = true;
+	hopalong_view_set_title_dirty(view);
+
+	/* make sure a frame is scheduled to regenerate the title */
+	if (view->primary_output != NULL)
+		wlr_output_schedule_frame(view->primary_output->wlr_output);
 }
 
-bool
-hopalong_view_generate_textures(struct hopalong_output *output, struct hopalong_view *view)
+static uint32_t
+get_msec(void)
 {
-	return_val_if_fail(output != NULL, false);
-	return_val_if_fail(view != NULL, false);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	if (view->title_dirty && !hopalong_view_generate_title_texture(output, view))
-		return false;
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-	return true;
+/*
+ * Renders the queued titles.  Titles of views which are not focused or not
+ * shown on any output are rendered at most every TITLE_THROTTLE_MSEC; they
+ * stay queued, and the title timer comes back for them.
+ */
+void
+hopalong_view_render_dirty_titles(struct hopalong_server *server)
+{
+	return_if_fail(server != NULL);
+
+	uint32_t now = get_msec();
+	int next_delay = 0;
+
+	struct hopalong_view *view, *next;
+	wl_list_for_each_safe(view, next, &server->dirty_titles, title_link)
+	{
+		/* one title at a time; the latest is rendered when it is done */
+		if (view->title_job != NULL)
+			continue;
+
+		bool background = !view->activated || view->primary_output == NULL;
+		uint32_t elapsed = now - view->title_rendered_msec;
+
+		if (background && view->title_rendered_msec != 0 && elapsed < TITLE_THROTTLE_MSEC)
+		{
+			int delay = TITLE_THROTTLE_MSEC - elapsed;
+			if (next_delay == 0 || delay < next_delay)
+				next_delay = delay;
+
+			continue;
+		}
+
+		hopalong_view_dequeue_title(view);
+
+		/* out of memory, so try again when the timer comes back */
+		if (!hopalong_view_generate_textures(view))
+		{
+			hopalong_view_set_title_dirty(view);
+			next_delay = TITLE_THROTTLE_MSEC;
+			break;
+		}
+
+		view->title_rendered_msec = now;
+		server->titles_rendered++;
+	}
+
+	if (next_delay > 0)
+		wl_event_source_timer_update(server->title_timer, next_delay);
+}
+
+int
+hopalong_view_title_timer_notify(void *data)
+{
+	struct hopalong_server *server = data;
+	return_val_if_fail(server != NULL, 0);
+
+	hopalong_view_render_dirty_titles(server);
+
+	return 0;
+}
+
+/*
+ * Takes a view off the queue of titles to render.
+ */
+void
+hopalong_view_dequeue_title(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
+
+	if (!view->title_queued)
+		return;
+
+	wl_list_remove(&view->title_link);
+	view->title_queued = false;
 }
 
 void
@@ -283,22 +639,77 @@ hopalong_view_getprop(struct hopalong_view *view, enum hopalong_view_prop prop)
 	return view->ops->getprop(view, prop);
 }
 
+/*
+ * Stops pointing the view's surface back at the view.
+ */
+static void
+unlink_surface(struct hopalong_view *view)
+{
+	struct wlr_surface *surface = view->linked_surface;
+	if (surface == NULL)
+		return;
+
+	if (surface->data == view)
+		surface->data = NULL;
+
+	wl_list_remove(&view->linked_surface_destroy.link);
+	view->linked_surface = NULL;
+}
+
+static void
+linked_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct hopalong_view *view = wl_container_of(listener, view, linked_surface_destroy);
+	unlink_surface(view);
+}
+
+/*
+ * Points a surface back at the view showing it, until either goes away.
+ */
+static void
+link_surface(struct hopalong_view *view, struct wlr_surface *surface)
+{
+	if (surface == view->linked_surface)
+		return;
+
+	unlink_surface(view);
+
+	if (surface == NULL)
+		return;
+
+	surface->data = view;
+	view->linked_surface = surface;
+
+	view->linked_surface_destroy.notify = linked_surface_destroy;
+	wl_signal_add(&surface->events.destroy, &view->linked_surface_destroy);
+}
+
 void
 hopalong_view_destroy(struct hopalong_view *view)
 {
 	return_if_fail(view != NULL);
 
 	wl_list_remove(&view->link);
+	hopalong_view_dequeue_title(view);
 
 	if (view->mapped)
-		wl_list_remove(&view->mapped_link);
-
-	if (view->title != NULL)
 	{
-		wlr_texture_destroy(view->title);
-		wlr_texture_destroy(view->title_inactive);
+		wl_list_remove(&view->mapped_link);
+		view->mapped = false;
+		hopalong_view_damage_whole(view);
 	}
 
+	hopalong_view_release_title(view);
+
+	unlink_surface(view);
+
+	if (view->resize_timeout != NULL)
+		wl_event_source_remove(view->resize_timeout);
+
+	/* a title still being rendered is thrown away when done */
+	if (view->title_job != NULL)
+		view->title_job->view = NULL;
+
 	free(view);
 }
 
@@ -311,18 +722,20 @@ hopalong_view_get_surface(struct hopalong_view *view)
 	return view->ops->get_surface(view);
 }
 
+/*
+ * Mapped views point their surface back at themselves, so that focus
+ * changes and commits find their view without walking all of them.  Only
+ * root surfaces of views are ever pointed back.
+ */
 static struct hopalong_view *
 hopalong_view_from_wlr_surface(struct hopalong_server *server, struct wlr_surface *surface)
 {
-	struct hopalong_view *view;
+	return_val_if_fail(server != NULL, NULL);
 
-	wl_list_for_each(view, &server->views, link)
-	{
-		if (surface == hopalong_view_get_surface(view))
-			return view;
-	}
+	if (surface == NULL)
+		return NULL;
 
-	return NULL;
+	return surface->data;
 }
 
 void
@@ -332,7 +745,12 @@ hopalong_view_set_activated(struct hopalong_view *view, bool activated)
 	return_if_fail(view->ops != NULL);
 
 	view->ops->set_activated(view, activated);
-	view->activated = activated;
+
+	if (view->activated != activated)
+	{
+		view->activated = activated;
+		hopalong_view_damage_whole(view);
+	}
 }
 
 void
@@ -381,15 +799,171 @@ hopalong_view_get_geometry(struct hopalong_view *view, struct wlr_box *box)
 	return view->ops->get_geometry(view, box);
 }
 
-void
+/*
+ * Asks the client to change the size of its view.  Returns the serial of
+ * the configure sent, or 0 for shells without configure serials.
+ */
+uint32_t
 hopalong_view_set_size(struct hopalong_view *view, int new_width, int new_height)
 {
-	return_if_fail(view != NULL);
-	return_if_fail(view->ops != NULL);
+	return_val_if_fail(view != NULL, 0);
+	return_val_if_fail(view->ops != NULL, 0);
 
 	return view->ops->set_size(view, new_width, new_height);
 }
 
+static int hopalong_view_resize_timeout_notify(void *data);
+
+/*
+ * Moves the view so that its geometry ends up where the resize asked for,
+ * keeping the edges opposite to the ones dragged in place even if the
+ * client chose a different size.
+ */
+static void
+apply_resize_position(struct hopalong_view *view, const struct wlr_box *box, uint32_t edges)
+{
+	struct wlr_box geo_box = {};
+	hopalong_view_get_geometry(view, &geo_box);
+
+	view->x = box->x - geo_box.x;
+	view->y = box->y - geo_box.y;
+
+	if (edges & WLR_EDGE_LEFT)
+		view->x += box->width - geo_box.width;
+
+	if (edges & WLR_EDGE_TOP)
+		view->y += box->height - geo_box.height;
+
+	hopalong_view_damage_whole(view);
+}
+
+static void
+send_resize(struct hopalong_view *view, const struct wlr_box *box, uint32_t edges)
+{
+	/* X11 windows are their own geometry, and are told where they are with their size */
+	if (!hopalong_view_has_configure_serials(view))
+	{
+		view->x = box->x;
+		view->y = box->y;
+
+		hopalong_view_set_size(view, box->width, box->height);
+		hopalong_view_damage_whole(view);
+		return;
+	}
+
+	struct wlr_box geo_box = {};
+	hopalong_view_get_geometry(view, &geo_box);
+
+	/* the client has nothing to do if only the position changes */
+	if (geo_box.width == box->width && geo_box.height == box->height)
+	{
+		apply_resize_position(view, box, edges);
+		return;
+	}
+
+	uint32_t serial = hopalong_view_set_size(view, box->width, box->height);
+
+	if (view->resize_timeout == NULL)
+	{
+		struct wl_event_loop *loop = wl_display_get_event_loop(view->server->display);
+		view->resize_timeout = wl_event_loop_add_timer(loop, hopalong_view_resize_timeout_notify, view);
+	}
+
+	view->resize_in_flight = true;
+	view->resize_serial = serial;
+	view->resize_box = *box;
+	view->resize_edges = edges;
+
+	if (view->resize_timeout != NULL)
+		wl_event_source_timer_update(view->resize_timeout, RESIZE_TIMEOUT_MSEC);
+}
+
+static void
+finish_resize(struct hopalong_view *view)
+{
+	view->resize_in_flight = false;
+
+	if (view->resize_timeout != NULL)
+		wl_event_source_timer_update(view->resize_timeout, 0);
+
+	/* the new size and position show up together */
+	apply_resize_position(view, &view->resize_box, view->resize_edges);
+
+	if (view->resize_queued)
+	{
+		view->resize_queued = false;
+		send_resize(view, &view->resize_queued_box, view->resize_queued_edges);
+	}
+}
+
+/*
+ * Drops the resize in flight and any queued one, e.g. because the view is
+ * unmapped and its client will not commit a buffer for them.
+ */
+static void
+cancel_resize(struct hopalong_view *view)
+{
+	view->resize_in_flight = false;
+	view->resize_queued = false;
+
+	if (view->resize_timeout != NULL)
+		wl_event_source_timer_update(view->resize_timeout, 0);
+}
+
+static int
+hopalong_view_resize_timeout_notify(void *data)
+{
+	struct hopalong_view *view = data;
+	return_val_if_fail(view != NULL, 0);
+
+	/* the client is too slow, so go on without it */
+	if (view->resize_in_flight)
+		finish_resize(view);
+
+	return 0;
+}
+
+/*
+ * Resizes a view interactively, to the geometry given in layout coordinates.
+ * Only one configure is in flight at a time: the view is moved when the
+ * client commits a buffer of the new size, and sizes asked for meanwhile
+ * are coalesced into the next configure.
+ */
+void
+hopalong_view_resize(struct hopalong_view *view, const struct wlr_box *box, uint32_t edges)
+{
+	return_if_fail(view != NULL);
+	return_if_fail(box != NULL);
+
+	if (view->resize_in_flight)
+	{
+		view->resize_queued = true;
+		view->resize_queued_box = *box;
+		view->resize_queued_edges = edges;
+		return;
+	}
+
+	send_resize(view, box, edges);
+}
+
+/*
+ * Called by shells when the client committed the state of a configure.
+ */
+void
+hopalong_view_resize_committed(struct hopalong_view *view, uint32_t serial)
+{
+	return_if_fail(view != NULL);
+
+	if (!view->resize_in_flight)
+		return;
+
+	/* still catching up with an older configure */
+	if ((int32_t) (serial - view->resize_serial) < 0)
+		return;
+
+	finish_resize(view);
+}
+
 void
 hopalong_view_map(struct hopalong_view *view)
 {
@@ -400,8 +974,17 @@ hopalong_view_map(struct hopalong_view *view)
 
 	view->mapped = true;
 
+	/* X11 windows only have a surface once mapped, and may get a new one */
+	link_surface(view, hopalong_view_get_surface(view));
+
 	wl_list_insert(&server->mapped_layers[view->layer], &view->mapped_link);
 	hopalong_view_set_activated(view, true);
+
+	/* the title may have changed while the view was unmapped */
+	if (view->title_dirty)
+		hopalong_view_set_title_dirty(view);
+
+	hopalong_view_damage_whole(view);
 }
 
 void
@@ -411,7 +994,14 @@ hopalong_view_unmap(struct hopalong_view *view)
 
 	view->mapped = false;
 
+	/* X11 windows lose their surface after this, and it may outlive the view */
+	unlink_surface(view);
+
 	wl_list_remove(&view->mapped_link);
+	hopalong_view_dequeue_title(view);
+	cancel_resize(view);
+
+	hopalong_view_damage_whole(view);
 }
 
 void
@@ -451,3 +1041,304 @@ hopalong_view_can_resize(struct hopalong_view *view)
 
 	return view->ops->can_resize(view);
 }
+
+bool
+hopalong_view_has_configure_serials(struct hopalong_view *view)
+{
+	return_val_if_fail(view != NULL, false);
+	return_val_if_fail(view->ops != NULL, false);
+
+	return view->ops->has_configure_serials(view);
+}
+
+void
+hopalong_view_for_each_surface(struct hopalong_view *view, wlr_surface_iterator_func_t iterator, void *data)
+{
+	return_if_fail(view != NULL);
+	return_if_fail(iterator != NULL);
+
+	if (view->xdg_surface != NULL)
+	{
+		wlr_xdg_surface_for_each_surface(view->xdg_surface, iterator, data);
+		return;
+	}
+	else if (view->layer_surface != NULL)
+	{
+		wlr_layer_surface_v1_for_each_surface(view->layer_surface, iterator, data);
+		return;
+	}
+	else if (view->xwayland_surface != NULL)
+	{
+		struct wlr_surface *surface = hopalong_view_get_surface(view);
+
+		if (surface != NULL)
+			iterator(surface, 0, 0, data);
+
+		return;
+	}
+
+	wlr_log(WLR_ERROR, "hopalong_view_for_each_surface: don't know how to iterate view %p", view);
+}
+
+/*
+ * Grows dest to cover box as well.  Empty boxes take up no room.
+ */
+void
+hopalong_view_box_union(struct wlr_box *dest, const struct wlr_box *box)
+{
+	if (!box->width || !box->height)
+		return;
+
+	if (!dest->width || !dest->height)
+	{
+		*dest = *box;
+		return;
+	}
+
+	int x1 = box->x < dest->x ? box->x : dest->x;
+	int y1 = box->y < dest->y ? box->y : dest->y;
+	int x2 = box->x + box->width;
+	int y2 = box->y + box->height;
+
+	if (x2 < dest->x + dest->width)
+		x2 = dest->x + dest->width;
+	if (y2 < dest->y + dest->height)
+		y2 = dest->y + dest->height;
+
+	*dest = (struct wlr_box){
+		.x = x1,
+		.y = y1,
+		.width = x2 - x1,
+		.height = y2 - y1,
+	};
+}
+
+static void
+extend_bounds(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	struct wlr_box box = {
+		.x = sx,
+		.y = sy,
+		.width = surface->current.width,
+		.height = surface->current.height,
+	};
+
+	if (box.width && box.height)
+		hopalong_view_box_union(data, &box);
+}
+
+/*
+ * Computes the extents of a view in layout coordinates, including its
+ * popups, subsurfaces and server-side decorations.
+ */
+bool
+hopalong_view_get_bounds(struct hopalong_view *view, struct wlr_box *box)
+{
+	return_val_if_fail(view != NULL, false);
+	return_val_if_fail(box != NULL, false);
+
+	*box = (struct wlr_box){};
+	hopalong_view_for_each_surface(view, extend_bounds, box);
+
+	if (!view->using_csd && hopalong_decoration_update(view))
+	{
+		for (size_t i = 0; i < view->decoration.nquads; i++)
+			hopalong_view_box_union(box, &view->decoration.quads[i].box);
+	}
+
+	box->x += view->x;
+	box->y += view->y;
+
+	return box->width && box->height;
+}
+
+/*
+ * Lays out a view's decorations and hit boxes in layout coordinates, after
+ * it was configured, moved, resized or restyled.  Rendering and hit testing
+ * both work from the result.
+ */
+void
+hopalong_view_update_layout(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
+
+	for (size_t i = 0; i < HOPALONG_VIEW_FRAME_AREA_COUNT; i++)
+		view->frame_areas[i] = (struct wlr_box){};
+
+	if (view->using_csd || !hopalong_decoration_update(view))
+		return;
+
+	for (size_t i = 0; i < HOPALONG_VIEW_FRAME_AREA_COUNT; i++)
+	{
+		const struct wlr_box *area = &view->decoration.frame_areas[i];
+
+		if (!area->width && !area->height)
+			continue;
+
+		view->frame_areas[i] = (struct wlr_box){
+			.x = area->x + view->x,
+			.y = area->y + view->y,
+			.width = area->width,
+			.height = area->height,
+		};
+	}
+}
+
+static void
+damage_box_on_outputs(struct hopalong_server *server, const struct wlr_box *box)
+{
+	struct hopalong_output *output;
+
+	wl_list_for_each(output, &server->outputs, link)
+		hopalong_output_damage_box(output, box);
+}
+
+/*
+ * Damages the area a view used to cover as well as the area it covers now,
+ * e.g. after it was moved, resized, restacked or restyled.
+ */
+void
+hopalong_view_damage_whole(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
+
+	struct hopalong_server *server = view->server;
+	return_if_fail(server != NULL);
+
+	damage_box_on_outputs(server, &view->bounds);
+	view->bounds = (struct wlr_box){};
+
+	/* whatever changed, the view is not where hit testing saw it anymore */
+	hopalong_shell_invalidate_hit_grid(server);
+
+	if (!view->mapped)
+		return;
+
+	hopalong_view_update_layout(view);
+
+	if (hopalong_view_get_bounds(view, &view->bounds))
+		damage_box_on_outputs(server, &view->bounds);
+
+	hopalong_view_update_primary_output(view);
+}
+
+/*
+ * Picks the output which shows the largest part of a view.
+ */
+void
+hopalong_view_update_primary_output(struct hopalong_view *view)
+{
+	return_if_fail(view != NULL);
+
+	struct hopalong_server *server = view->server;
+	return_if_fail(server != NULL);
+
+	view->primary_output = NULL;
+
+	if (!view->mapped)
+		return;
+
+	int best_area = 0;
+	struct hopalong_output *output;
+
+	wl_list_for_each(output, &server->outputs, link)
+	{
+		struct wlr_box *output_box = wlr_output_layout_get_box(server->output_layout, output->wlr_output);
+		if (output_box == NULL)
+			continue;
+
+		struct wlr_box intersection;
+		if (!wlr_box_intersection(&intersection, output_box, &view->bounds))
+			continue;
+
+		int area = intersection.width * intersection.height;
+		if (area > best_area)
+		{
+			best_area = area;
+			view->primary_output = output;
+		}
+	}
+}
+
+struct surface_damage_data {
+	struct hopalong_view *view;
+	struct wlr_surface *surface;
+};
+
+static void
+damage_committed_surface(struct wlr_surface *surface, int sx, int sy, void *data)
+{
+	struct surface_damage_data *ddata = data;
+
+	if (surface != ddata->surface)
+		return;
+
+	struct hopalong_view *view = ddata->view;
+	struct hopalong_output *output;
+
+	wl_list_for_each(output, &view->server->outputs, link)
+		hopalong_output_damage_surface(output, surface, view->x + sx, view->y + sy);
+}
+
+static struct wlr_surface *
+toplevel_surface_for_surface(struct wlr_surface *surface)
+{
+	surface = wlr_surface_get_root_surface(surface);
+
+	/* popups are not subsurfaces, so walk up to the surface owning them */
+	while (wlr_surface_is_xdg_surface(surface))
+	{
+		struct wlr_xdg_surface *xdg_surface = wlr_xdg_surface_from_wlr_surface(surface);
+
+		if (xdg_surface == NULL || xdg_surface->role != WLR_XDG_SURFACE_ROLE_POPUP ||
+		    xdg_surface->popup == NULL || xdg_surface->popup->parent == NULL)
+			break;
+
+		surface = wlr_surface_get_root_surface(xdg_surface->popup->parent);
+	}
+
+	return surface;
+}
+
+/*
+ * Called whenever any client surface is committed.  Translates the damage
+ * the client reported into output damage, and makes sure a frame is
+ * scheduled if the client is waiting on a frame callback.
+ */
+void
+hopalong_view_damage_from_surface(struct hopalong_server *server, struct wlr_surface *surface)
+{
+	return_if_fail(server != NULL);
+	return_if_fail(surface != NULL);
+
+	struct hopalong_view *view = hopalong_view_from_wlr_surface(server, toplevel_surface_for_surface(surface));
+	if (view == NULL || !view->mapped)
+		return;
+
+	/* the new buffer may change which of its pixels accept input */
+	hopalong_shell_invalidate_last_hit(server);
+
+	/* if the view changed size, repaint all of it */
+	struct wlr_box bounds;
+	hopalong_view_get_bounds(view, &bounds);
+
+	if (bounds.x != view->bounds.x || bounds.y != view->bounds.y ||
+	    bounds.width != view->bounds.width || bounds.height != view->bounds.height)
+		hopalong_view_damage_whole(view);
+	else
+	{
+		struct surface_damage_data ddata = {
+			.view = view,
+			.surface = surface,
+		};
+
+		hopalong_view_for_each_surface(view, damage_committed_surface, &ddata);
+	}
+
+	if (wl_list_empty(&surface->current.frame_callback_list))
+		return;
+
+	/* frame callbacks are only sent from the primary output */
+	if (view->primary_output != NULL)
+		wlr_output_schedule_frame(view->primary_output->wlr_output);
+}
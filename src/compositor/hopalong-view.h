@@ -31,12 +31,16 @@
 #include <wlr/types/wlr_xdg_shell.h>
 #include <wlr/util/log.h>
 #include <xkbcommon/xkbcommon.h>
+#include <pango/pangocairo.h>
 
 #include "hopalong-style.h"
+#include "hopalong-atlas.h"
 
 struct hopalong_output;
 struct hopalong_server;
 struct hopalong_view;
+struct hopalong_title_job;
+struct hopalong_title_cache_entry;
 
 /*
  * Hopalong has five layers, mediated by the wlr-layer-shell, xdg-shell and
@@ -69,6 +73,62 @@ enum hopalong_view_prop {
 	HOPALONG_VIEW_APP_ID,
 };
 
+/*
+ * Images a decoration can show.  They are rendered for every output scale,
+ * so the decoration layout only names them; the image for the scale of the
+ * output being drawn is looked up at render time.
+ */
+enum hopalong_decoration_image {
+	HOPALONG_DECORATION_IMAGE_NONE,
+	HOPALONG_DECORATION_IMAGE_TITLE,
+	HOPALONG_DECORATION_IMAGE_MINIMIZE,
+	HOPALONG_DECORATION_IMAGE_MAXIMIZE,
+	HOPALONG_DECORATION_IMAGE_CLOSE,
+};
+
+/*
+ * A piece of server-side decoration, relative to the view's position in
+ * layout coordinates.  Either a solid rectangle or an image from the
+ * decoration atlas, tinted with color if one is given.
+ */
+struct hopalong_decoration_quad {
+	struct wlr_box box;
+	const float *color;
+	enum hopalong_decoration_image image;
+};
+
+#define HOPALONG_DECORATION_MAX_QUADS	(9)
+
+/*
+ * A view's title, rendered for one output scale.  The text is kept as a
+ * white coverage mask, so the same image serves active and inactive views,
+ * and is shared with other views showing the same title.
+ */
+struct hopalong_view_title {
+	float scale;
+	struct hopalong_title_cache_entry *cached;
+};
+
+#define HOPALONG_VIEW_MAX_SCALES	(4)
+
+/*
+ * The layout of a view's server-side decorations, kept until the view is
+ * resized, (de)activated, retitled or its title bar is toggled.
+ */
+struct hopalong_decoration {
+	bool valid;
+
+	/* the state the layout was computed for */
+	int width, height;
+	bool activated;
+	bool hide_title_bar;
+
+	struct wlr_box frame_areas[HOPALONG_VIEW_FRAME_AREA_COUNT];
+
+	size_t nquads;
+	struct hopalong_decoration_quad quads[HOPALONG_DECORATION_MAX_QUADS];
+};
+
 struct hopalong_view_ops {
 	void (*minimize)(struct hopalong_view *view);
 	void (*maximize)(struct hopalong_view *view);
@@ -77,10 +137,11 @@ struct hopalong_view_ops {
 	struct wlr_surface *(*get_surface)(struct hopalong_view *view);
 	void (*set_activated)(struct hopalong_view *view, bool activated);
 	bool (*get_geometry)(struct hopalong_view *view, struct wlr_box *box);
-	void (*set_size)(struct hopalong_view *view, int width, int height);
+	uint32_t (*set_size)(struct hopalong_view *view, int width, int height);
 	struct wlr_surface *(*surface_at)(struct hopalong_view *view, double x, double y, double *sx, double *sy);
 	bool (*can_move)(struct hopalong_view *view);
 	bool (*can_resize)(struct hopalong_view *view);
+	bool (*has_configure_serials)(struct hopalong_view *view);
 };
 
 struct hopalong_view {
@@ -104,21 +165,60 @@ struct hopalong_view {
 	struct wl_listener request_resize;
 	struct wl_listener set_title;
 	struct wl_listener surface_commit;
+
+	/* the surface pointing back at this view, while it is mapped */
+	struct wlr_surface *linked_surface;
+	struct wl_listener linked_surface_destroy;
 	bool mapped;
 	int x, y;
 
+	/* the area last damaged on behalf of this view, in layout coordinates */
+	struct wlr_box bounds;
+
+	/* the output showing most of this view, which drives its frame callbacks */
+	struct hopalong_output *primary_output;
+
+	/* decoration hit boxes, in layout coordinates */
 	struct wlr_box frame_areas[HOPALONG_VIEW_FRAME_AREA_COUNT];
 
 	/* the area of the frame the pointer is hovering over if any */
 	int frame_area;
 	int frame_area_edges;
 
-	/* textures owned by this view */
-	struct wlr_texture *title;
-	struct wlr_texture *title_inactive;
+	/* textures owned by this view, one title per output scale */
+	struct hopalong_view_title titles[HOPALONG_VIEW_MAX_SCALES];
+	size_t ntitles;
+	struct hopalong_title_job *title_job;
+
+	/* the width titles were ellipsized to, in layout coordinates */
+	int title_max_width;
+	bool title_ellipsized;
 	struct wlr_box title_box;
 	bool title_dirty;
 
+	/* set by the client, and not rendered yet */
+	bool title_pending;
+
+	/* link in the server's queue of titles to render */
+	struct wl_list title_link;
+	bool title_queued;
+
+	/* when the title was last rendered, for throttling */
+	uint32_t title_rendered_msec;
+
+	/* the interactive resize waiting for the client, and the next one */
+	bool resize_in_flight;
+	uint32_t resize_serial;
+	struct wlr_box resize_box;
+	uint32_t resize_edges;
+	bool resize_queued;
+	struct wlr_box resize_queued_box;
+	uint32_t resize_queued_edges;
+	struct wl_event_source *resize_timeout;
+
+	/* cached server-side decoration layout */
+	struct hopalong_decoration decoration;
+
 	/* client-side decorations */
 	bool using_csd;
 	bool activated;
@@ -126,18 +226,30 @@ struct hopalong_view {
 };
 
 struct hopalong_generated_textures {
-	struct wlr_texture *minimize;
-	struct wlr_texture *minimize_inactive;
+	struct wl_list link;
+	float scale;
+
+	struct hopalong_atlas_entry *minimize;
+	struct hopalong_atlas_entry *minimize_inactive;
 
-	struct wlr_texture *maximize;
-	struct wlr_texture *maximize_inactive;
+	struct hopalong_atlas_entry *maximize;
+	struct hopalong_atlas_entry *maximize_inactive;
 
-	struct wlr_texture *close;
-	struct wlr_texture *close_inactive;
+	struct hopalong_atlas_entry *close;
+	struct hopalong_atlas_entry *close_inactive;
 };
 
-extern struct hopalong_generated_textures *hopalong_generate_builtin_textures_for_output(struct hopalong_output *output, const struct hopalong_style *style);
-extern bool hopalong_view_generate_textures(struct hopalong_output *output, struct hopalong_view *view);
+extern struct hopalong_generated_textures *hopalong_generated_textures_for_scale(struct hopalong_server *server, float scale);
+extern void hopalong_generated_textures_prune(struct hopalong_server *server);
+extern void hopalong_generated_textures_destroy_all(struct hopalong_server *server);
+extern bool hopalong_view_generate_textures(struct hopalong_view *view);
+extern void hopalong_view_finish_title(struct hopalong_view *view, struct hopalong_title_job *job);
+extern const struct hopalong_view_title *hopalong_view_get_title(struct hopalong_view *view, float scale);
+extern void hopalong_view_set_title_dirty(struct hopalong_view *view);
+extern void hopalong_view_dequeue_title(struct hopalong_view *view);
+extern void hopalong_view_title_changed(struct hopalong_view *view);
+extern void hopalong_view_render_dirty_titles(struct hopalong_server *server);
+extern int hopalong_view_title_timer_notify(void *data);
 
 extern void hopalong_view_minimize(struct hopalong_view *view);
 extern void hopalong_view_maximize(struct hopalong_view *view);
@@ -148,12 +260,22 @@ extern void hopalong_view_destroy(struct hopalong_view *view);
 extern struct wlr_surface *hopalong_view_get_surface(struct hopalong_view *view);
 extern void hopalong_view_set_activated(struct hopalong_view *view, bool activated);
 extern bool hopalong_view_get_geometry(struct hopalong_view *view, struct wlr_box *box);
-extern void hopalong_view_set_size(struct hopalong_view *view, int new_width, int new_height);
+extern uint32_t hopalong_view_set_size(struct hopalong_view *view, int new_width, int new_height);
+extern void hopalong_view_resize(struct hopalong_view *view, const struct wlr_box *box, uint32_t edges);
+extern void hopalong_view_resize_committed(struct hopalong_view *view, uint32_t serial);
 extern void hopalong_view_map(struct hopalong_view *view);
 extern void hopalong_view_unmap(struct hopalong_view *view);
 extern void hopalong_view_reparent(struct hopalong_view *view);
 extern struct wlr_surface *hopalong_view_surface_at(struct hopalong_view *view, double x, double y, double *sx, double *sy);
 extern bool hopalong_view_can_move(struct hopalong_view *view);
 extern bool hopalong_view_can_resize(struct hopalong_view *view);
+extern bool hopalong_view_has_configure_serials(struct hopalong_view *view);
+extern void hopalong_view_box_union(struct wlr_box *dest, const struct wlr_box *box);
+extern void hopalong_view_for_each_surface(struct hopalong_view *view, wlr_surface_iterator_func_t iterator, void *data);
+extern bool hopalong_view_get_bounds(struct hopalong_view *view, struct wlr_box *box);
+extern void hopalong_view_damage_whole(struct hopalong_view *view);
+extern void hopalong_view_update_layout(struct hopalong_view *view);
+extern void hopalong_view_update_primary_output(struct hopalong_view *view);
+extern void hopalong_view_damage_from_surface(struct hopalong_server *server, struct wlr_surface *surface);
 
 #endif
@@ -57,7 +57,7 @@ static void
 hopalong_xdg_toplevel_set_title(struct wl_listener *listener, void *data)
 {
 	struct hopalong_view *view = wl_container_of(listener, view, set_title);
-	view->title_dirty = true;
+	hopalong_view_title_changed(view);
 }
 
 static void
@@ -176,10 +176,10 @@ hopalong_xdg_toplevel_get_geometry(struct hopalong_view *view, struct wlr_box *b
 	return true;
 }
 
-static void
+static uint32_t
 hopalong_xdg_toplevel_set_size(struct hopalong_view *view, int width, int height)
 {
-	wlr_xdg_toplevel_set_size(view->xdg_surface, width, height);
+	return wlr_xdg_toplevel_set_size(view->xdg_surface, width, height);
 }
 
 static struct wlr_surface *
@@ -212,6 +212,12 @@ hopalong_xdg_toplevel_can_resize(struct hopalong_view *view)
 	return true;
 }
 
+static bool
+hopalong_xdg_toplevel_has_configure_serials(struct hopalong_view *view)
+{
+	return true;
+}
+
 static const struct hopalong_view_ops hopalong_xdg_view_ops = {
 	.minimize = hopalong_xdg_toplevel_minimize,
 	.maximize = hopalong_xdg_toplevel_maximize,
@@ -224,6 +230,7 @@ static const struct hopalong_view_ops hopalong_xdg_view_ops = {
 	.surface_at = hopalong_xdg_toplevel_surface_at,
 	.can_move = hopalong_xdg_toplevel_can_move,
 	.can_resize = hopalong_xdg_toplevel_can_resize,
+	.has_configure_serials = hopalong_xdg_toplevel_has_configure_serials,
 };
 
 static void
@@ -237,6 +244,10 @@ hopalong_xdg_surface_commit(struct wl_listener *listener, void *data)
 	view->using_csd = false;
 	if (view->xdg_surface->current.geometry.x || view->xdg_surface->current.geometry.y)
 		view->using_csd = true;
+
+	/* the buffer for an interactive resize may have arrived */
+	if (view->resize_in_flight)
+		hopalong_view_resize_committed(view, view->xdg_surface->current.configure_serial);
 }
 
 static void
@@ -47,7 +47,7 @@ static void
 hopalong_xwayland_set_title(struct wl_listener *listener, void *data)
 {
 	struct hopalong_view *view = wl_container_of(listener, view, set_title);
-	view->title_dirty = true;
+	hopalong_view_title_changed(view);
 }
 
 static void
@@ -114,10 +114,11 @@ hopalong_xwayland_toplevel_get_geometry(struct hopalong_view *view, struct wlr_b
 	return true;
 }
 
-static void
+static uint32_t
 hopalong_xwayland_toplevel_set_size(struct hopalong_view *view, int width, int height)
 {
 	wlr_xwayland_surface_configure(view->xwayland_surface, view->x, view->y, width, height);
+	return 0;
 }
 
 static struct wlr_surface *
@@ -155,6 +156,13 @@ hopalong_xwayland_toplevel_can_resize(struct hopalong_view *view)
 	return true;
 }
 
+/* X11 configures take effect without the client acknowledging them */
+static bool
+hopalong_xwayland_toplevel_has_configure_serials(struct hopalong_view *view)
+{
+	return false;
+}
+
 static const struct hopalong_view_ops hopalong_xwayland_view_ops = {
 	.minimize = hopalong_xwayland_toplevel_minimize,
 	.maximize = hopalong_xwayland_toplevel_maximize,
@@ -167,6 +175,7 @@ static const struct hopalong_view_ops hopalong_xwayland_view_ops = {
 	.surface_at = hopalong_xwayland_toplevel_surface_at,
 	.can_move = hopalong_xwayland_toplevel_can_move,
 	.can_resize = hopalong_xwayland_toplevel_can_resize,
+	.has_configure_serials = hopalong_xwayland_toplevel_has_configure_serials,
 };
 
 static void
@@ -181,6 +190,8 @@ hopalong_xwayland_request_configure(struct wl_listener *listener, void *data)
 	view->x = ev->x + 128;
 	view->y = ev->y + 128;
 
+	hopalong_view_damage_whole(view);
+
 	if (xsurface->surface != NULL)
 		hopalong_view_focus(view, xsurface->surface);
 }